@@ -0,0 +1,238 @@
+/*
+ * Memory accounting for letters.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * Everything that owns memory is handed a reallocator by allocator(),
+ * which frees when asked for 0 bytes.  Normally that is just realloc,
+ * but with -M each subsystem gets a counting reallocator that puts a
+ * header holding the size in front of each block, so that frees and
+ * reallocs can be charged correctly, and keeps the number of calls,
+ * the bytes asked for, the live and peak live bytes, and a histogram
+ * of sizes by power of two.  Memory that curses allocates for itself
+ * cannot be seen this way, so its owner charges it with alloc_charge().
+ */
+
+#include "letters.h"
+
+#include <stdatomic.h>
+
+#define SIZE_CLASSES 25  /* the last holds everything of 16M or more */
+
+union header {
+	size_t size;
+	max_align_t align;
+};
+
+static struct counts {
+	atomic_ulong allocs;
+	atomic_ulong reallocs;
+	atomic_ulong frees;
+	atomic_ullong bytes;   /* total asked for */
+	atomic_llong live;
+	atomic_llong peak;
+	atomic_ulong size[SIZE_CLASSES];
+} counts[A_COUNT];
+
+static const char *names[A_COUNT] = {
+	[A_DICTIONARY] = "dictionary",
+	[A_BONUS] = "bonus dictionary",
+	[A_SCORES] = "high scores",
+	[A_WINDOWS] = "curses windows",
+	[A_SCREEN] = "screen buffers",
+	[A_GRID] = "screen grid",
+};
+
+static bool counting;
+static bool reporting;  /* alloc_report() prints the counts */
+
+
+/* realloc that frees when asked for 0 bytes */
+static void *
+plain_realloc(void *p, size_t n)
+{
+	if (n == 0) {
+		free(p);
+		return NULL;
+	}
+	return realloc(p, n);
+}
+
+
+static unsigned
+size_class(size_t n)
+{
+	unsigned c = 0;
+
+	while (n > 1 && c < SIZE_CLASSES - 1) {
+		n = (n + 1) / 2;
+		c += 1;
+	}
+	return c;
+}
+
+
+static void
+add_live(struct counts *c, long long delta)
+{
+	long long live = atomic_fetch_add_explicit(&c->live, delta,
+		memory_order_relaxed) + delta;
+	long long peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+
+	while (
+		live > peak && ! atomic_compare_exchange_weak_explicit(&c->peak,
+			&peak, live, memory_order_relaxed, memory_order_relaxed)
+	) {
+		;
+	}
+}
+
+
+static void *
+counting_realloc(enum subsystem s, void *p, size_t n)
+{
+	struct counts *c = counts + s;
+	union header *h = p ? (union header *)p - 1 : NULL;
+	size_t old = h ? h->size : 0;
+
+	if (n == 0) {
+		if (h) {
+			atomic_fetch_add_explicit(&c->frees, 1,
+				memory_order_relaxed);
+			add_live(c, -(long long)old);
+		}
+		free(h);
+		return NULL;
+	}
+	if ((h = realloc(h, sizeof *h + n)) == NULL) {
+		return NULL;
+	}
+	h->size = n;
+	atomic_fetch_add_explicit(p ? &c->reallocs : &c->allocs, 1,
+		memory_order_relaxed);
+	atomic_fetch_add_explicit(&c->bytes, n, memory_order_relaxed);
+	atomic_fetch_add_explicit(c->size + size_class(n), 1,
+		memory_order_relaxed);
+	add_live(c, (long long)n - (long long)old);
+	return h + 1;
+}
+
+
+#define COUNTING(name, s) \
+	static void *name(void *p, size_t n) \
+	{ \
+		return counting_realloc(s, p, n); \
+	}
+COUNTING(count_dictionary, A_DICTIONARY)
+COUNTING(count_bonus, A_BONUS)
+COUNTING(count_scores, A_SCORES)
+COUNTING(count_windows, A_WINDOWS)
+COUNTING(count_screen, A_SCREEN)
+COUNTING(count_grid, A_GRID)
+#undef COUNTING
+
+static const reallocator counters[A_COUNT] = {
+	[A_DICTIONARY] = count_dictionary,
+	[A_BONUS] = count_bonus,
+	[A_SCORES] = count_scores,
+	[A_WINDOWS] = count_windows,
+	[A_SCREEN] = count_screen,
+	[A_GRID] = count_grid,
+};
+
+
+/*
+ * Count allocations from now on, and if report is true, have
+ * alloc_report() print them.  Must be called before any are made.
+ */
+void
+alloc_count(bool report)
+{
+	counting = true;
+	reporting = reporting || report;
+}
+
+
+/* Return the reallocator for subsystem s */
+reallocator
+allocator(enum subsystem s)
+{
+	return counting ? counters[s] : plain_realloc;
+}
+
+
+/*
+ * Charge bytes allocated (or, if negative, freed) out of our sight
+ * to subsystem s.
+ */
+void
+alloc_charge(enum subsystem s, long long bytes)
+{
+	struct counts *c = counts + s;
+
+	if (! counting || bytes == 0) {
+		return;
+	}
+	if (bytes > 0) {
+		atomic_fetch_add_explicit(&c->allocs, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&c->bytes, bytes,
+			memory_order_relaxed);
+		atomic_fetch_add_explicit(c->size + size_class(bytes), 1,
+			memory_order_relaxed);
+	} else {
+		atomic_fetch_add_explicit(&c->frees, 1, memory_order_relaxed);
+	}
+	add_live(c, bytes);
+}
+
+
+/* Return the number of allocations counted so far, of any size */
+unsigned long
+alloc_total(void)
+{
+	unsigned long n = 0;
+
+	for (int s = 0; s < A_COUNT; s += 1) {
+		n += atomic_load_explicit(&counts[s].allocs,
+			memory_order_relaxed);
+	}
+	return n;
+}
+
+
+/* Print the counts for each subsystem that allocated anything */
+void
+alloc_report(FILE *fp)
+{
+	if (! reporting) {
+		return;
+	}
+	fprintf(fp, "%-17s %8s %8s %8s %10s %10s %10s\n", "memory", "allocs",
+		"reallocs", "frees", "bytes", "peak", "live");
+	for (int s = 0; s < A_COUNT; s += 1) {
+		struct counts *c = counts + s;
+		unsigned long calls = c->allocs + c->reallocs + c->frees;
+		const char *sep = "  sizes:";
+
+		if (calls == 0) {
+			continue;
+		}
+		fprintf(fp, "%-17s %8lu %8lu %8lu %10llu %10lld %10lld\n",
+			names[s], (unsigned long)c->allocs,
+			(unsigned long)c->reallocs, (unsigned long)c->frees,
+			(unsigned long long)c->bytes, (long long)c->peak,
+			(long long)c->live);
+		for (int i = 0; i < SIZE_CLASSES; i += 1) {
+			if (c->size[i]) {
+				fprintf(fp, "%s %s%zu:%lu", sep,
+					i == SIZE_CLASSES - 1 ? ">=" : "<=",
+					(size_t)1 << i,
+					(unsigned long)c->size[i]);
+				sep = "";
+			}
+		}
+		fputc('\n', fp);
+	}
+}
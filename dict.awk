@@ -0,0 +1,90 @@
+# Generate dict.c from dict.c.in and the word list.
+#
+# usage: LC_ALL=C awk -v dictionary=PATH -v block=N -f dict.awk dict.c.in
+#
+# Words of 3 bytes or fewer, or of more than 223, are skipped.  The
+# words are front coded in blocks of N: the first word of a block is
+# stored as its length and its bytes, and each of the others as the
+# length of the prefix it shares with the word before it, the length
+# of the rest of it, and the rest of it.  A number in the second field
+# of a line is the relative frequency of the word in the first.
+
+BEGIN {
+	n = 0
+	for (i = 1; i < 256; i++) {
+		ord[sprintf("%c", i)] = i
+	}
+	while ((getline line < dictionary) > 0) {
+		nf = split(line, field)
+		if (nf == 0 || length(field[1]) <= 3 || length(field[1]) > 223) {
+			continue
+		}
+		word[n] = field[1]
+		freq[n] = nf > 1 ? field[2] + 0 : 1
+		weighted = weighted || nf > 1
+		n++
+	}
+	close(dictionary)
+}
+
+function octal(c) {
+	return sprintf("\\%03o", c)
+}
+
+# Quote s for a C string, escaping anything that is not plain ASCII
+function quote(s,    i, c, out) {
+	out = ""
+	for (i = 1; i <= length(s); i++) {
+		c = substr(s, i, 1)
+		if (ord[c] < 32 || ord[c] > 126 || c == "\"" || c == "\\" || c == "?") {
+			out = out octal(ord[c])
+		} else {
+			out = out c
+		}
+	}
+	return out
+}
+
+function shared(a, b,    i) {
+	for (i = 0; i < length(a) && substr(a, i + 1, 1) == substr(b, i + 1, 1); i++) {
+		;
+	}
+	return i
+}
+
+/@blocks@/ {
+	pos = 0
+	for (i = 0; i < n; i++) {
+		if (i % block == 0) {
+			offset[i / block] = pos
+			printf "\t\"%s%s\"\n", octal(length(word[i])), quote(word[i])
+			pos += 1 + length(word[i])
+		} else {
+			p = shared(word[i - 1], word[i])
+			rest = substr(word[i], p + 1)
+			printf "\t\"%s%s%s\"\n", octal(p), octal(length(rest)), quote(rest)
+			pos += 2 + length(rest)
+		}
+	}
+	next
+}
+
+/@block@/ {
+	for (b = 0; b * block < n; b++) {
+		printf "\t%d,\n", offset[b]
+	}
+	next
+}
+
+/@weights@/ {
+	for (i = 0; weighted && i < n; i++) {
+		printf "\t%g,\n", freq[i]
+	}
+	next
+}
+
+{
+	gsub(/@count@/, n)
+	gsub(/@fc_block@/, block)
+	print
+}
@@ -0,0 +1,164 @@
+/*
+ * Per-character and per-bigram typing statistics for letters.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * check_matches() knows which character the typist was aiming at and
+ * which one was pressed.  Record that here in fixed tables indexed by
+ * (7-bit) character so that the key path costs a couple of array
+ * increments.  drill_difficulty() turns the tables into a score that
+ * the adaptive word sampler in word.c uses to favor weak bigrams.
+ * A bigram seen only a few times is judged mostly by how its second
+ * character fares after any other, so a typist weak on a character is
+ * drilled on bigrams with it before each one has been seen.  The first
+ * character of a word is counted as a bigram after WORD_START.
+ */
+
+#include "letters.h"
+
+#define NCHAR 128
+
+/* Latencies longer than this are pauses, not typing */
+#define MAX_LATENCY_MS 2000
+
+/*
+ * Beta prior on the error rate of a character that has not been seen:
+ * as if it had been typed PRIOR_HITS + PRIOR_MISSES times with
+ * PRIOR_MISSES errors.
+ */
+#define PRIOR_HITS 19
+#define PRIOR_MISSES 1
+
+/*
+ * A bigram is taken to have been typed this many times more, at the
+ * error rate and latency of its second character.
+ */
+#define PRIOR_BIGRAM 5
+
+/* How strongly an excess error rate raises a word's weight */
+#define ERROR_GAIN 20.0
+/* How strongly an excess latency raises a word's weight */
+#define LATENCY_GAIN 0.5
+
+struct keystat {
+	unsigned hit;
+	unsigned miss;
+	unsigned latency; /* sum of ms over hits with a known latency */
+	unsigned timed;   /* number of hits in latency */
+};
+
+static struct keystat chars[NCHAR];
+static struct keystat bigrams[NCHAR][NCHAR];
+static struct keystat total;
+static uint64_t last_key;
+
+
+static unsigned
+elapsed_ms(uint64_t now)
+{
+	uint64_t ms = (now - last_key) / 1000000;
+	return (last_key == 0 || ms > MAX_LATENCY_MS) ? 0 : ms;
+}
+
+
+static void
+record(struct keystat *k, bool hit, unsigned ms)
+{
+	if (hit) {
+		k->hit += 1;
+		if (ms) {
+			k->latency += ms;
+			k->timed += 1;
+		}
+	} else {
+		k->miss += 1;
+	}
+}
+
+
+/*
+ * Record one keystroke.  expect is the character the typist was
+ * aiming at (0 if unknown) and prev the one before it in the same
+ * word, or WORD_START if it is the first.  Every key is passed in,
+ * with the monotonic time t at which it was read, so that latencies
+ * are measured from the previous one.
+ */
+void
+drill_key(int prev, int expect, int key, uint64_t t)
+{
+	unsigned ms = elapsed_ms(t);
+	bool hit = key == expect;
+
+	last_key = t;
+
+	if (expect <= 0 || expect >= NCHAR) {
+		return;
+	}
+	record(&total, hit, ms);
+	record(chars + expect, hit, ms);
+	if (prev >= 0 && prev < NCHAR) {
+		record(&bigrams[prev][expect], hit, ms);
+	}
+}
+
+
+static double
+error_rate(const struct keystat *k)
+{
+	return (k->miss + PRIOR_MISSES)
+		/ (double)(k->hit + k->miss + PRIOR_HITS + PRIOR_MISSES);
+}
+
+
+/* Return the mean latency of k, or of c where k has little to go on */
+static double
+latency(const struct keystat *k, const struct keystat *c)
+{
+	double mean = c->timed ? c->latency / (double)c->timed : 0;
+
+	if (k->timed + c->timed == 0) {
+		return 0;
+	}
+	return (k->latency + PRIOR_BIGRAM * mean)
+		/ (k->timed + (c->timed ? PRIOR_BIGRAM : 0));
+}
+
+
+/*
+ * Return a non-negative score that grows with the number of bigrams
+ * in s that the typist gets wrong, or types slowly, more often than
+ * average.
+ */
+double
+drill_difficulty(const char *s)
+{
+	double base = (double)PRIOR_MISSES / (PRIOR_HITS + PRIOR_MISSES);
+	double mean = total.timed ? total.latency / (double)total.timed : 0;
+	double score = 0.0;
+
+	for (int a = WORD_START; *s; a = (unsigned char)*s++) {
+		unsigned char b = *s;
+		struct keystat *k, *c;
+		double e, ms;
+
+		if (a >= NCHAR || b >= NCHAR) {
+			continue;
+		}
+		k = &bigrams[a][b];
+		c = chars + b;
+		e = (k->miss + PRIOR_BIGRAM * error_rate(c))
+			/ (k->hit + k->miss + PRIOR_BIGRAM) - base;
+		if (e > 0.0) {
+			score += ERROR_GAIN * e;
+		}
+		if ((ms = latency(k, c)) > 0.0 && mean > 0.0) {
+			double slow = ms / mean - 1.0;
+			if (slow > 0.0) {
+				score += LATENCY_GAIN * slow;
+			}
+		}
+	}
+	return score;
+}
@@ -0,0 +1,153 @@
+/*
+ * Screen occupancy for letters.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * Every cell of the screen has a count of the words covering it, and
+ * each row a bitmap of the cells whose count is not zero.  Words add
+ * and remove themselves as they move, so the grid is always current,
+ * and finding room for a word is a matter of a few shifts and ands
+ * over the row's bitmap, 64 cells at a time, instead of comparing
+ * the word with every other word in play.
+ */
+
+#include "letters.h"
+
+#define BITS 64
+
+
+/* Size the grid to the screen.  Return true if it had to be cleared. */
+bool
+grid_fit(struct grid *g, int rows, int cols)
+{
+	reallocator r = allocator(A_GRID);
+	size_t n, nbits;
+
+	if (g->rows == rows && g->cols == cols) {
+		return false;
+	}
+	g->rows = rows;
+	g->cols = cols;
+	g->stride = (cols + BITS - 1) / BITS + 1;  /* one spare for shifts */
+	n = (size_t)rows * cols;
+	n = n ? n : 1;
+	nbits = (size_t)(rows ? rows : 1) * g->stride;
+	g->bits = r(g->bits, nbits * sizeof *g->bits);
+	g->count = r(g->count, n * sizeof *g->count);
+	if (g->bits == NULL || g->count == NULL) {
+		die("out of memory");
+	}
+	memset(g->bits, 0, nbits * sizeof *g->bits);
+	memset(g->count, 0, n * sizeof *g->count);
+	return true;
+}
+
+
+/* Add delta to the count of the cells [x, x + width) of row y */
+void
+grid_mark(struct grid *g, int y, int x, int width, int delta)
+{
+	uint64_t *bits;
+	unsigned char *count;
+
+	if (y < 0 || y >= g->rows) {
+		return;
+	}
+	bits = g->bits + (size_t)y * g->stride;
+	count = g->count + (size_t)y * g->cols;
+	for (int i = x < 0 ? 0 : x; i < x + width && i < g->cols; i += 1) {
+		if ((count[i] += delta) == 0) {
+			bits[i / BITS] &= ~(1ULL << i % BITS);
+		} else {
+			bits[i / BITS] |= 1ULL << i % BITS;
+		}
+	}
+}
+
+
+/* Return true iff none of the cells [x, x + width) of row y are in use */
+bool
+grid_free(const struct grid *g, int y, int x, int width)
+{
+	const unsigned char *count;
+
+	if (y < 0 || y >= g->rows || x < 0 || x + width > g->cols) {
+		return false;
+	}
+	count = g->count + (size_t)y * g->cols;
+	for (int i = x; i < x + width; i += 1) {
+		if (count[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/* dst = dst & (src >> k), where both are rows of g->stride words */
+static void
+and_shifted(uint64_t *dst, const uint64_t *src, int k, int stride)
+{
+	int q = k / BITS, r = k % BITS;
+
+	for (int i = 0; i < stride; i += 1) {
+		uint64_t lo = i + q < stride ? src[i + q] : 0;
+		uint64_t hi = i + q + 1 < stride ? src[i + q + 1] : 0;
+		dst[i] &= r ? lo >> r | hi << (BITS - r) : lo;
+	}
+}
+
+
+/*
+ * Return a column chosen at random, with the stream rng, from those
+ * at which width free cells of row y start, or -1 if there are none.
+ */
+int
+grid_find(const struct grid *g, int y, int width, unsigned short rng[3])
+{
+	const uint64_t *bits;
+	int words = g->stride ? g->stride : 1;
+	uint64_t start[words], run[words];
+	unsigned total = 0, pick;
+
+	if (y < 0 || y >= g->rows || width < 1 || width > g->cols) {
+		return -1;
+	}
+	bits = g->bits + (size_t)y * g->stride;
+	/* Free cells, with everything past the edge of the screen in use */
+	for (int i = 0; i < g->stride; i += 1) {
+		int valid = g->cols - i * BITS;
+		uint64_t mask = valid >= BITS ? ~0ULL :
+			valid > 0 ? (1ULL << valid) - 1 : 0;
+		start[i] = ~bits[i] & mask;
+	}
+	/* Keep the cells that begin a run of width free cells, by doubling */
+	for (int len = 1; len < width; ) {
+		int k = len < width - len ? len : width - len;
+		memcpy(run, start, sizeof run);
+		and_shifted(start, run, k, g->stride);
+		len += k;
+	}
+	for (int i = 0; i < g->stride; i += 1) {
+		total += __builtin_popcountll(start[i]);
+	}
+	if (total == 0) {
+		return -1;
+	}
+	pick = nrand48(rng) % total;
+	for (int i = 0; i < g->stride; i += 1) {
+		unsigned n = __builtin_popcountll(start[i]);
+		uint64_t b = start[i];
+		if (pick >= n) {
+			pick -= n;
+			continue;
+		}
+		while (pick--) {
+			b &= b - 1;
+		}
+		return i * BITS + __builtin_ctzll(b);
+	}
+	return -1;
+}
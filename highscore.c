@@ -28,12 +28,40 @@ static time_t readtime;
 
 char *score_header = "    name       level  words  score";
 
+
+/*
+ * Open the high score file with a stdio buffer from the high score
+ * allocator, so that -M sees it.
+ */
+static FILE *
+open_scores(const char *path, const char *mode, char **buf)
+{
+	FILE *fp = fopen(path, mode);
+
+	*buf = NULL;
+	if (fp && (*buf = allocator(A_SCORES)(NULL, BUFSIZ)) != NULL) {
+		setvbuf(fp, *buf, _IOFBF, BUFSIZ);
+	}
+	return fp;
+}
+
+
+static int
+close_scores(FILE *fp, char *buf)
+{
+	int rv = fclose(fp);
+
+	allocator(A_SCORES)(buf, 0);
+	return rv;
+}
+
 int
 read_scores(void)
 {
 	char *highscores = HIGHSCORES;
 	struct score_rec *h = high_scores;
 	FILE		 *fp;
+	char		 *buf;
 
 	/*
 	 * get the last modified time so we know later if we have to reread
@@ -42,7 +70,7 @@ read_scores(void)
 	 */
 	if(
 		stat(highscores, &s_buf) == -1 ||
-		(fp = fopen(highscores, "r")) == NULL
+		(fp = open_scores(highscores, "r", &buf)) == NULL
 	) {
 		perror(highscores);
 		return 1;
@@ -56,7 +84,7 @@ read_scores(void)
 		h += 1;
 	}
 
-	fclose(fp);
+	close_scores(fp, buf);
 	return 0;
 }
 
@@ -64,6 +92,7 @@ int
 write_scores() {
 	int	i;
 	FILE	*fp;
+	char	*buf;
 	char *highscores = HIGHSCORES;
 
 	/*
@@ -81,7 +110,7 @@ write_scores() {
 	if(s_buf.st_mtime > readtime)
 		return -1;
 
-	if((fp = fopen(highscores, "w")) == NULL) {
+	if((fp = open_scores(highscores, "w", &buf)) == NULL) {
 		endwin();
 		perror(highscores);
 		exit(1);
@@ -97,7 +126,7 @@ write_scores() {
 		);
 	}
 
-	return fclose(fp);
+	return close_scores(fp, buf);
 }
 
 
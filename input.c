@@ -0,0 +1,277 @@
+/*
+ * Keyboard input for letters.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * An input thread reads the terminal as soon as anything arrives,
+ * stamps each key with the time it was read, and pushes it into a
+ * single-producer, single-consumer ring.  The game loop drains the
+ * ring between frames, so however long a frame takes to draw, the
+ * time recorded for each key is the time it was typed, not the time
+ * the game got round to it.  The thread writes a byte to a pipe
+ * after each burst to wake the game loop, which waits on the pipe
+ * rather than on the terminal.
+ *
+ * Characters are decoded in the current locale.  Escape sequences,
+ * such as those sent by the arrow keys, are discarded: the game has
+ * no use for them.  curses no longer reads the terminal, so window
+ * size changes are caught here too and handed to the game loop as
+ * KEY_RESIZE.
+ */
+
+#include "letters.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+
+/* must be a power of 2 */
+#define RING_SIZE 256
+
+static struct {
+	struct {
+		int key;
+		uint64_t t;
+	} ring[RING_SIZE];
+	_Atomic unsigned head;  /* next slot to be written by the thread */
+	_Atomic unsigned tail;  /* next slot to be read by the game */
+	int wake[2];            /* written after each burst of keys */
+	int stop[2];            /* written to stop the thread */
+	volatile sig_atomic_t resized;
+	bool running;
+	pthread_t reader;
+} T = { .wake = { -1, -1 }, .stop = { -1, -1 } };
+
+
+/*
+ * Put a key in the ring, waiting for the game to make room if it has
+ * fallen behind.  Return false, with the key dropped, if the thread is
+ * told to stop meanwhile.
+ */
+static bool
+push(int key, uint64_t t)
+{
+	struct pollfd stop = { .fd = T.stop[0], .events = POLLIN };
+	unsigned head = atomic_load_explicit(&T.head, memory_order_relaxed);
+
+	while (head - atomic_load_explicit(&T.tail, memory_order_acquire)
+			== RING_SIZE) {
+		if (write(T.wake[1], "", 1) == -1) {
+			;  /* the pipe is full, so the game is awake anyway */
+		}
+		if (poll(&stop, 1, 1) > 0) {
+			return false;
+		}
+	}
+	T.ring[head % RING_SIZE].key = key;
+	T.ring[head % RING_SIZE].t = t;
+	atomic_store_explicit(&T.head, head + 1, memory_order_release);
+	return true;
+}
+
+
+static void *
+reader(void *arg)
+{
+	struct pollfd fds[2] = {
+		{ .fd = STDIN_FILENO, .events = POLLIN },
+		{ .fd = T.stop[0], .events = POLLIN },
+	};
+	enum { TEXT, ESCAPE, CSI, SS3 } esc = TEXT;
+	mbstate_t st;
+	char buf[256];
+
+	memset(&st, 0, sizeof st);
+	while (poll(fds, 2, -1) != -1 || errno == EINTR) {
+		ssize_t n;
+		uint64_t t;
+
+		if (fds[1].revents) {
+			break;
+		}
+		if (! fds[0].revents) {
+			continue;
+		}
+		if ((n = read(STDIN_FILENO, buf, sizeof buf)) <= 0) {
+			if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+				break;
+			}
+			continue;
+		}
+		t = monotonic_ns();
+		for (char *p = buf; p < buf + n; ) {
+			unsigned char c = *p;
+			wchar_t w;
+			size_t k;
+
+			switch (esc) {
+			case ESCAPE:
+				esc = c == '[' ? CSI : c == 'O' ? SS3 : TEXT;
+				p += 1;
+				continue;
+			case CSI:
+				esc = c >= 0x40 && c <= 0x7e ? TEXT : CSI;
+				p += 1;
+				continue;
+			case SS3:
+				esc = TEXT;
+				p += 1;
+				continue;
+			case TEXT:
+				break;
+			}
+			if (c == '\033') {
+				esc = ESCAPE;
+				p += 1;
+				continue;
+			}
+			k = mbrtowc(&w, p, buf + n - p, &st);
+			if (k == (size_t)-2) {
+				/* the rest of the character is still to come */
+				break;
+			}
+			if (k == 0 || k == (size_t)-1) {
+				w = c;
+				k = 1;
+				memset(&st, 0, sizeof st);
+			}
+			if (! push(w, t)) {
+				return arg;
+			}
+			p += k;
+		}
+		if (write(T.wake[1], "", 1) == -1) {
+			;  /* the pipe is full, so the game is awake anyway */
+		}
+	}
+	return arg;
+}
+
+
+static void
+handle_winch(int s)
+{
+	int e = errno;
+
+	(void)s;
+	T.resized = 1;
+	if (write(T.wake[1], "", 1) == -1) {
+		;
+	}
+	errno = e;
+}
+
+
+static void
+make_pipe(int fd[2])
+{
+	if (pipe(fd) == -1) {
+		die("pipe");
+	}
+	for (int i = 0; i < 2; i += 1) {
+		fcntl(fd[i], F_SETFL, fcntl(fd[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fd[i], F_SETFD, FD_CLOEXEC);
+	}
+}
+
+
+/* Start reading keys from the terminal.  Must follow screen_init(). */
+void
+input_start(void)
+{
+	struct sigaction act;
+	sigset_t all, old;
+
+	make_pipe(T.wake);
+	make_pipe(T.stop);
+
+	memset(&act, 0, sizeof act);
+	act.sa_handler = handle_winch;
+	if (sigaction(SIGWINCH, &act, NULL)) {
+		die("sigaction");
+	}
+
+	/* Leave the signals to the game loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&T.reader, NULL, reader, NULL)) {
+		die("pthread_create");
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	T.running = true;
+}
+
+
+/* Stop reading keys, leaving the terminal to curses */
+void
+input_stop(void)
+{
+	if (T.running) {
+		if (write(T.stop[1], "", 1) == -1) {
+			;
+		}
+		pthread_join(T.reader, NULL);
+		T.running = false;
+	}
+}
+
+
+static bool
+pending(void)
+{
+	return T.resized || atomic_load_explicit(&T.head, memory_order_acquire)
+		!= atomic_load_explicit(&T.tail, memory_order_relaxed);
+}
+
+
+/*
+ * Take the next key from the ring and the time it was read.  Return
+ * false if there is none.  A change in window size is returned as
+ * the key -KEY_RESIZE, after curses has been told of the new size.
+ */
+bool
+input_get(int *key, uint64_t *t)
+{
+	unsigned tail = atomic_load_explicit(&T.tail, memory_order_relaxed);
+
+	if (T.resized) {
+		struct winsize ws;
+
+		T.resized = 0;
+		if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) {
+			resizeterm(ws.ws_row, ws.ws_col);
+		}
+		*key = -KEY_RESIZE;
+		*t = monotonic_ns();
+		return true;
+	}
+	if (tail == atomic_load_explicit(&T.head, memory_order_acquire)) {
+		return false;
+	}
+	*key = T.ring[tail % RING_SIZE].key;
+	*t = T.ring[tail % RING_SIZE].t;
+	atomic_store_explicit(&T.tail, tail + 1, memory_order_release);
+	return true;
+}
+
+
+/*
+ * Wait up to ms milliseconds (forever if ms is negative) for a key.
+ * A signal cuts the wait short.  Return true if a key is waiting.
+ */
+bool
+input_wait(int ms)
+{
+	struct pollfd fd = { .fd = T.wake[0], .events = POLLIN };
+	char buf[64];
+
+	if (! pending() && poll(&fd, 1, ms) > 0) {
+		while (read(T.wake[0], buf, sizeof buf) > 0) {
+			;
+		}
+	}
+	return pending();
+}
@@ -42,27 +42,29 @@
  * value needed that is appropriate for that typing speed.
  *
  * Add an option to dampen (or disable) lateral movement.
- *
- * Randomize the speed.  Occasionally have a long word be faster.
  */
 
 # define CTRL(c)  (c & 0x1f)
 
 #include "letters.h"
 
-static volatile sig_atomic_t tick; /* total number of SIGALRM received */
-
-static struct word word_store[256];
+static volatile sig_atomic_t tick; /* SIGALRMs received, to wake the loop */
 
 static struct word * add_word(struct state *);
-static int banner(struct state *, const char *, int);
+static void banner(struct state *, const char *, int);
+static void end_banner(struct state *);
+static void handle_key(struct state *, int, uint64_t);
 static void display_words(struct state *);
+static int frame_wait(struct state *);
+static void render(struct state *);
 static void finalize_word(struct state *S, struct word *w);
 static void game(struct state *);
 static struct word * maybe_add_word(struct state *);
 static int move_words(struct state *);
 static void new_level(struct state *);
 static void putword(struct word *);
+static void report_race(struct state *);
+static void report_stats(struct state *);
 static void set_handlers(void);
 static void set_timer(unsigned long);
 static void status(struct state *);
@@ -73,13 +75,43 @@ void
 usage(const char *progname)
 {
 	printf("usage: %s ", progname);
-	puts(" [-hH] [-l start-level] [-d dictionary] [-s string]\n");
+	puts(" [-aghHMS] [-l start-level] [-d dictionary] [-s string]");
+	puts("    [-f fps] [-R rate]");
+	puts("    [-t log] [-b backend] [-m file] [-p passage] [-W model]");
+	puts("    [--race path] [--trace-startup[=file]]\n");
 	puts("option:");
+	puts("  -a     favor words that exercise your weak spots");
+	puts("  -b     draw the screen with curses (default) or ansi");
+	puts("  -g     make up words like those of the word list");
 	puts("  -h     print usage statement");
 	puts("  -H     print high score list");
 	puts("  -l     start the game a start-level");
+	puts("  -m     keep live counters of the game in file, or in a dir");
+	puts("  -M     count memory allocations and print them at exit");
 	puts("  -d     initialize word list from the given path");
+	puts("  -f     redraw the screen at most fps times per second");
+	puts("  -p     type the words of passage in order (- for stdin)");
+	puts("  -R     bring in new words at rate a second, at every level");
 	puts("  -s     generate random strings from characters in string");
+	puts("  -S     print session statistics at exit");
+	puts("  -t     append a record of the session to log");
+	puts("  -W     write a model of the words for -d to model, and exit");
+	puts("  --race race the game that meets this one at the socket path");
+	puts("  --trace-startup");
+	puts("         time each phase of startup, and print the times at");
+	puts("         exit or write them to file as a Chrome trace");
+}
+
+/* Return the micro-seconds per tick a game starts with at level */
+static unsigned
+start_speed(const struct state *S, int level)
+{
+	unsigned us = US_PER_TICK;
+
+	for (int i = 1; i < level; i += 1) {
+		us *= S->decay_rate;
+	}
+	return us;
 }
 
 static void
@@ -102,33 +134,80 @@ check_tty(void)
 static void
 intrrpt(struct state *S)
 {
-	switch(banner(S, "Are you sure you want to quit?", 0)) {
+	banner(S, "Are you sure you want to quit?", 0);
+}
+
+
+/* Take key as the answer to the question asked by intrrpt() */
+static void
+answer(struct state *S, int key)
+{
+	switch(key) {
 	case 'y':
 	case 'Y':
 	case CTRL('C'):
 		longjmp(S->jbuf, 1);
 	default:
-		display_words(S);
+		end_banner(S);
 	}
 }
 
 
+/* Handle an option of the form --name value or --name=value */
+static int
+handle_long_argument(struct state *S, char **argv)
+{
+	char *arg = *argv + 2;
+	char *eq = strchr(arg, '=');
+	size_t len = eq ? (size_t)(eq - arg) : strlen(arg);
+	char *v = eq ? eq + 1 : argv[1];
+
+	if (len == 4 && strncmp(arg, "race", len) == 0) {
+		if (v == NULL || *v == '\0') {
+			die("Option --race requires an argument");
+		}
+		S->race = v;
+		return eq ? 1 : 2;
+	}
+	if (len == 13 && strncmp(arg, "trace-startup", len) == 0) {
+		trace_startup(eq && eq[1] ? eq + 1 : NULL);
+		return 1;
+	}
+	return die("Unknown option: %s", *argv);
+}
+
+
 static int
 handle_argument(struct state *S, char **argv, char *progname)
 {
 	char *end;
 	char *arg = *argv;
 
+	if (arg[1] == '-') {
+		return handle_long_argument(S, argv);
+	}
 	switch(arg[1]) {
+	case 'a':
+		S->adaptive = true;
+		return 1;
+	case 'g':
+		S->pseudo = true;
+		return 1;
 	case 'h':
 		usage(progname);
 		exit(0);
+	case 'M':
+		alloc_count(true);
+		return 1;
 	case 'H':
 		puts(score_header);
 		for (char s[64]; next_score(s, sizeof s); ) {
 			printf("%s\n", s);
 		}
 		exit(0);
+	case 'S':
+		S->stats = true;
+		return 1;
 	}
 
 	char *v = (arg[1] && arg[2]) ? arg + 2 : argv[1];
@@ -141,9 +220,7 @@ handle_argument(struct state *S, char **argv, char *progname)
 		/* TODO: Convoluted spaghetti code will increment level
 		 * once before the game begins, so subtract one here. */
 		S->level = (int)strtol(v, &end, 0) - 1;
-		for (int i = 1; i < S->level; i += 1 ){
-			S->us_per_tick *= S->decay_rate;
-		}
+		S->us_per_tick = start_speed(S, S->level);
 		if (*end || S->level < 1) {
 			die("Invalid level %s", v);
 		}
@@ -154,6 +231,41 @@ handle_argument(struct state *S, char **argv, char *progname)
 	case 's':
 		S->choice = v;
 		break;
+	case 't':
+		S->log = v;
+		break;
+	case 'm':
+		S->live = v;
+		break;
+	case 'W':
+		S->model = v;
+		break;
+	case 'p':
+		S->passage = v;
+		break;
+	case 'b':
+		if (strcmp(v, "curses") == 0) {
+			S->backend = B_CURSES;
+		} else if (strcmp(v, "ansi") == 0) {
+			S->backend = B_ANSI;
+		} else {
+			die("Unknown backend %s", v);
+		}
+		break;
+	case 'R':
+		S->rate = strtod(v, &end);
+		if (*end || ! (S->rate > 0 && S->rate <= 100)) {
+			die("Invalid rate %s", v);
+		}
+		break;
+	case 'f': {
+		long fps = strtol(v, &end, 0);
+		if (*end || fps < 1 || fps > 1000) {
+			die("Invalid frame rate %s", v);
+		}
+		S->frame.interval_ms = 1000 / fps;
+		break;
+	}
 	default:
 		die("Unknown option: -%c", arg[1]);
 	}
@@ -182,20 +294,71 @@ parse_cmd_line(int argc, char **argv, struct state *S)
 static void
 initialize_words(struct state *S)
 {
-	struct word *e = word_store + sizeof word_store / sizeof *word_store;
+	struct word *e = S->store + WORD_STORE;
 
-	S->free = word_store;
-	for (struct word *w = word_store; w < e; w += 1) {
-		w->next = w + 1;
+	S->free = S->store;
+	for (struct word *w = S->store; w < e; w += 1) {
+		w->next = w + 1 < e ? w + 1 : NULL;
 	}
 }
 
 
+/* Seed the game's streams of random numbers, as srand48() would */
+static void
+seed_game(struct state *S, uint32_t seed)
+{
+	S->rng[0] = 0x330e;
+	S->word_rng[0] = 0x330f;
+	S->rng[1] = S->word_rng[1] = seed & 0xffff;
+	S->rng[2] = S->word_rng[2] = seed >> 16;
+}
+
+
+/*
+ * Meet the other game of a race and agree on the seed and the size
+ * of the screen.  The other game is replayed, from the keys it sends,
+ * in a state of its own, whose progress is shown on the bottom line.
+ */
+static void
+start_race(struct state *S)
+{
+	static struct state opponent[1];
+	struct race_hello theirs;
+	struct race_hello mine = {
+		.level = S->level,
+		.words = dictionary_fingerprint(),
+		.seed = S->rng[1] | (uint32_t)S->rng[2] << 16,
+		.rate = S->rate * 1000 + 0.5,
+	};
+
+	race_start(S->race, &mine, &theirs);
+	seed_game(S, mine.seed);
+	S->rows = mine.rows - 1;
+	S->cols = mine.cols;
+
+	initialize_words(opponent);
+	seed_game(opponent, theirs.seed);
+	opponent->replica = true;
+	opponent->level = theirs.level;
+	opponent->lives = S->lives;
+	opponent->addword = S->addword;
+	opponent->rate = theirs.rate / 1000.0;
+	opponent->decay_rate = S->decay_rate;
+	opponent->us_per_tick = start_speed(S, theirs.level);
+	opponent->rows = S->rows;
+	opponent->cols = S->cols;
+	opponent->race = S->race;
+	S->opponent = opponent;
+}
+
+
 static void
 init(struct state *S, int argc, char **argv)
 {
+	trace_phase("arguments");
 	unsetenv("COLUMNS");
 	unsetenv("LINES");
+	setlocale(LC_CTYPE, "");
 	initialize_words(S);
 
 	S->words = NULL;
@@ -203,28 +366,104 @@ init(struct state *S, int argc, char **argv)
 	S->dictionary = NULL;
 	S->addword = 1.0/18.0;
 	S->decay_rate = .93;
-	S->us_per_tick = 250000;
+	S->us_per_tick = US_PER_TICK;
+	S->frame.interval_ms = 1000 / MAX_FPS;
 
 	parse_cmd_line(argc, argv, S);
+	if (S->race && S->adaptive) {
+		die("Option -a can not be used in a race");
+	}
+	if (S->race && S->passage) {
+		die("Option -p can not be used in a race");
+	}
+
+	if (S->choice && (S->pseudo || S->model)) {
+		die("Options -g and -W can not be used with -s");
+	}
 
-	initialize_dictionary(S->dictionary, S->choice, realloc);
+	trace_phase("dictionary");
+	S->pseudo = initialize_dictionary(S->dictionary, S->choice,
+		S->pseudo || S->model, allocator(A_DICTIONARY),
+		allocator(A_BONUS));
+	if (S->model) {
+		save_word_model(S->model);
+		exit(0);
+	}
+	if (S->pseudo && S->adaptive) {
+		die("Option -a can not be used with made up words");
+	}
+	if (S->adaptive) {
+		adapt_dictionary(allocator(A_DICTIONARY));
+	}
+	/* Both sides of a race must draw from the same list throughout */
+	if (S->dictionary && ! S->choice && ! S->race && ! S->pseudo) {
+		dictionary_watch(S->dictionary);
+	}
+	if (S->passage) {
+		trace_phase("passage");
+		passage_open(S->passage);
+	}
+	trace_phase("tty check");
 	check_tty();
+	seed_game(S, time(NULL));
+	if (S->race) {
+		trace_phase("race");
+		start_race(S);
+	}
 
+	if (S->log) {
+		trace_phase("telemetry");
+		telemetry_open(S->log);
+		telemetry(EV_START, S->level + 1, (long long)time(NULL), 0,
+			username());
+	}
+	if (S->live) {
+		trace_phase("live counters");
+		live_open(S->live);
+	}
 	set_handlers();
-	srand48(time(NULL));
-	srandom(time(NULL));
-	initscr();
+	trace_phase("screen");
+	screen_init(S->backend, S->stats);
 	raw();
 	curs_set(0);
 	noecho();
 	keypad(stdscr, 1);
 	clear();
+	refresh();
+	trace_phase("input");
+	input_start();
 
+	trace_phase("first level");
+	metrics_start(&S->metrics, monotonic_ns());
 	new_level(S);
+	if (S->opponent) {
+		new_level(S->opponent);
+	}
+	trace_phase("first status");
 	status(S);
-	timeout(1000);
-	gettimeofday(&S->start_time.game, NULL);
-	gettimeofday(&S->start_time.level, NULL);
+	trace_done();
+}
+
+
+/*
+ * Return where the passage should resume: at the first word still in
+ * play.  Words missed are passed over, as they were in the game, and
+ * bonus words, with no place in the passage, are left out.
+ */
+static off_t
+resume_point(struct state *S)
+{
+	off_t pos = passage_tell();
+
+	for (struct word *w = S->words; w; w = w->next) {
+		if (
+			w->killed == 0 && w->pos >= 0
+			&& (pos < 0 || w->pos < pos)
+		) {
+			pos = w->pos;
+		}
+	}
+	return pos;
 }
 
 
@@ -241,48 +480,236 @@ main(int argc, char **argv)
 
 	game(S);
 
-	display_words(S);
-	banner(S, "Game Over", 3);
-
 exit:
+	race_end();
+	dictionary_unwatch();
 	free_dictionaries();
 	set_timer(0);
 	timeout(-1);
-	if ( !S->dictionary && S->choice == NULL) {
+	/* Only games dealt the usual words at the usual rate are ranked */
+	if (
+		! S->dictionary && S->choice == NULL && ! S->passage
+		&& ! S->pseudo && ! S->adaptive && S->rate == 0
+	) {
 		update_scores(&S->score, S->level);
 	}
+	if (S->passage) {
+		passage_close(resume_point(S));
+	}
+	update_wpm(S);
+	telemetry(EV_END, S->level, S->score.points, S->score.words, NULL);
+	input_stop();
+	screen_end();
 	show_scores(S);
 	endwin();
+	telemetry_close();
+	live_close();
+	if (S->stats) {
+		report_stats(S);
+	}
+	if (S->opponent) {
+		report_race(S);
+	}
+	trace_report(stdout);
+	alloc_report(stdout);
 
 	return 0;
 }
 
 
+static void
+report_stats(struct state *S)
+{
+	unsigned long f = S->frame.count;
+
+	printf("keys per frame: %.2f (%lu keys in %lu frames)\n",
+		f ? (double)S->input.keys / f : 0.0, S->input.keys, f);
+	printf("words per minute: %d (best 10 seconds: %d)\n",
+		S->rates.wpm[M_GAME], S->rates.burst);
+	printf("accuracy: %d%%\n", S->rates.accuracy[M_GAME]);
+	printf("ticks run late: %lu (%lu more given up)\n", S->wheel.overruns,
+		S->wheel.dropped);
+	screen_stats(stdout);
+}
+
+
+/* Say how the race went, as far as the other game has been heard from */
+static void
+report_race(struct state *S)
+{
+	struct state *O = S->opponent;
+
+	printf("you: %u points, %u words, level %u\n", S->score.points,
+		S->score.words, S->level);
+	printf("opponent: %u points, %u words, level %u%s\n", O->score.points,
+		O->score.words, O->level,
+		O->lives > 0 ? " (still playing)" : "");
+}
+
+
+/* Show the progress of the other game of a race on the bottom line */
+static void
+race_status(struct state *S)
+{
+	struct state *O = S->opponent;
+
+	screen_move(S->rows, 0);
+	screen_standout(true);
+	screen_printf("Opponent  Score: %-7u Level: %-3u Words: %-6u "
+		"Lives: %-3d%s",
+		O->score.points, O->level, O->score.words, O->lives,
+		O->lives == 0 ? "Game over" : race_over() ? "Gone" : "");
+	screen_clrtoeol();
+	screen_standout(false);
+}
+
+
 static void
 display_words(struct state *S)
 {
-	erase();
+	if (S->replica) {
+		return;
+	}
+	screen_erase();
 	status(S);
+	if (S->opponent) {
+		race_status(S);
+	}
 	for (struct word *w = S->words; w; w = w->next) {
 		putword(w);
 	}
-	refresh();
+	if (S->banner.text) {
+		int len = strlen(S->banner.text);
+
+		screen_overlay(S->banner.window, LINES / 3, (COLS - len) / 2,
+			S->banner.text);
+	}
+	screen_refresh();
+	S->frame.dirty = false;
+	S->frame.count += 1;
+	clock_gettime(CLOCK_MONOTONIC, &S->frame.last);
+}
+
+
+/* Return the number of ms until the next frame may be drawn */
+static int
+frame_wait(struct state *S)
+{
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - S->frame.last.tv_sec) * 1000
+		+ (now.tv_nsec - S->frame.last.tv_nsec) / 1000000;
+	return ms >= S->frame.interval_ms ? 0 : S->frame.interval_ms - ms;
+}
+
+
+/*
+ * Redraw the screen if anything has changed since the last frame and
+ * the frame interval has passed.  Everything that changes the state
+ * just sets frame.dirty, so however often the state changes the
+ * screen is redrawn at most once per frame interval.
+ */
+static void
+render(struct state *S)
+{
+	if (S->frame.dirty && frame_wait(S) == 0) {
+		display_words(S);
+	}
 }
 
 
+/*
+ * Words are kept in a hashed timing wheel by the tick of their next
+ * move, so each tick only looks at the words that are due to move
+ * then.  A word due more than WHEEL_SIZE ticks ahead shares a slot
+ * with earlier words and is passed over until its tick comes round.
+ */
 static void
-move_word(struct word *w)
+schedule(struct state *S, struct word *w)
 {
-	if ( ((tick % w->tick_per_move) != w->tick_mod) || w->killed) {
-		return;
+	unsigned long at = w->due;
+	struct word **slot;
+
+	if (at <= S->wheel.now) {
+		at = S->wheel.now + 1;
+		w->due = at;
+	}
+	slot = S->wheel.slot + at % WHEEL_SIZE;
+	w->wnext = *slot;
+	w->wprev = slot;
+	if (*slot) {
+		(*slot)->wprev = &w->wnext;
+	}
+	*slot = w;
+}
+
+
+static void
+unschedule(struct word *w)
+{
+	if (w->wprev) {
+		*w->wprev = w->wnext;
+		if (w->wnext) {
+			w->wnext->wprev = w->wprev;
+		}
+		w->wprev = NULL;
+	}
+}
+
+
+/* Add (delta = 1) or remove (delta = -1) the word's cells in the grid */
+static void
+occupy(struct state *S, struct word *w, int delta)
+{
+	grid_mark(&S->grid, w->y, (int)w->x, w->word.width, delta);
+}
+
+
+/* Resize the grid to the screen, putting back the words if it changed */
+static void
+fit_grid(struct state *S)
+{
+	/* In a race, both games play on the screen size they agreed */
+	if (! S->race) {
+		S->rows = LINES;
+		S->cols = COLS;
 	}
+	if (grid_fit(&S->grid, S->rows, S->cols)) {
+		for (struct word *w = S->words; w; w = w->next) {
+			occupy(S, w, 1);
+		}
+	}
+}
+
+
+/*
+ * Move the word down a row and sideways.  If the sideways move would
+ * put it on top of another word and going straight down would not,
+ * bounce off the other word instead.  The caller must put the word
+ * back in the grid.
+ */
+static void
+move_word(struct state *S, struct word *w)
+{
+	float x = w->x;
+
+	occupy(S, w, -1);
 	w->x +=  w->lateral / 9.0;
 	if (w->x < 0.0) {
 		w->x = 0.0;
 		w->lateral *= -1;
 	}
-	if ((int)w->x > (COLS - w->word.len) + 1) {
-		w->x = (float)(COLS - w->word.len);
+	if ((int)w->x > (S->cols - (w->word.width + 1)) + 1) {
+		w->x = (float)(S->cols - (w->word.width + 1));
+		w->lateral *= -1;
+	}
+	if ((int)w->x != (int)x
+		&& ! grid_free(&S->grid, w->y + 1, (int)w->x, w->word.width)
+		&& grid_free(&S->grid, w->y + 1, (int)x, w->word.width)
+	) {
+		w->x = x;
 		w->lateral *= -1;
 	}
 	w->y += 1;
@@ -290,25 +717,44 @@ move_word(struct word *w)
 
 
 /*
- * move all words down 1 or more lines.
+ * Move the words that are due to move in the next tick.
  * return the number of words that have fallen off the bottom of the screen
  */
 static int
 move_words(struct state *S)
 {
-	struct word *w = S->words;
 	int  died = 0;
+	unsigned long now = ++S->wheel.now;
+	struct word *w = S->wheel.slot[now % WHEEL_SIZE];
+	struct word *next;
 
-	while (w != NULL) {
-		move_word(w);
-		if (w->y > LINES - 1) {
-			if (!w->killed) {
-				w->killed = -3;
-				died += 1;
+	fit_grid(S);
+	S->wheel.slot[now % WHEEL_SIZE] = NULL;
+	for (; w != NULL; w = next) {
+		next = w->wnext;
+		w->wprev = NULL;
+		if (w->killed) {
+			continue;
+		}
+		if ((unsigned long)w->due > now) {
+			schedule(S, w);
+			continue;
+		}
+		move_word(S, w);
+		if (w->y > S->rows - 1) {
+			w->killed = -3;
+			died += 1;
+			if (! S->replica) {
+				telemetry(EV_MISS, S->level, S->bonus, 0,
+					w->word.data);
 			}
-			w->y = LINES - 1;
+			w->y = S->rows - 1;
+			occupy(S, w, 1);
+			continue;
 		}
-		w = w->next;
+		occupy(S, w, 1);
+		w->due += w->period;
+		schedule(S, w);
 	}
 
 	if (died > 0) {
@@ -335,17 +781,23 @@ putword(struct word *w)
 {
 	int idx = w->matches;
 
-	move(w->y, (int)w->x);
+	screen_move(w->y, (int)w->x);
 	if (! w->killed ){
-		assert(idx < w->word.len);
-		attron(A_STANDOUT);
-		addnstr(w->word.data, idx);
-		attroff(A_STANDOUT);
-		addstr(w->word.data + w->matches);
+		assert(idx < w->word.nchar);
+		screen_standout(true);
+		if (w->word.wide) {
+			screen_addnwstr(w->word.wide, idx);
+			screen_standout(false);
+			screen_addnwstr(w->word.wide + idx, -1);
+		} else {
+			screen_addnstr(w->word.data, idx);
+			screen_standout(false);
+			screen_addnstr(w->word.data + idx, -1);
+		}
 	} else {
-		for (int i = 0; i < w->word.len - 1; i += 1) {
+		for (int i = 0; i < w->word.width; i += 1) {
 			char t[] = "*#+  --";
-			addch(t[3 + w->killed]);
+			screen_addnstr(t + 3 + w->killed, 1);
 		}
 	}
 }
@@ -357,14 +809,19 @@ process_ctrl_key(struct state *S, int key)
 {
 	switch(key) {
 	case CTRL('L'):
+		screen_invalidate();
+		display_words(S);
+		break;
 	case KEY_RESIZE:
 		display_words(S);
 		break;
 	case CTRL('N'):
 		S->level += 1;
 		S->us_per_tick *= S->decay_rate;
-		set_timer(S->us_per_tick / 1000);
-		status(S);
+		if (! S->replica) {
+			set_timer(S->us_per_tick / 1000);
+			status(S);
+		}
 		break;
 	case CTRL('C'):
 		intrrpt(S);
@@ -374,40 +831,181 @@ process_ctrl_key(struct state *S, int key)
 
 /*
  * Check the key against each word and upate the "matches" member.
- * Update the curses window.  Return the number of words that match.
+ * The word with the longest typed prefix is taken to be the one the
+ * typist is aiming at, and the key is recorded against it.
  */
 static void
-check_matches(struct state *S, int key)
+check_matches(struct state *S, int key, uint64_t t)
 {
+	struct word *target = NULL;
+	int prev = 0;
+	int expect = 0;
+	bool hit = false;
+
 	for (struct word *w = S->words; w != NULL; w = w->next) {
 		if (w->killed) {
 			continue;
 		}
-		if (key == w->word.data[w->matches]) {
+		if (
+			w->matches > 0
+			&& (!target || w->matches > target->matches)
+		) {
+			target = w;
+			expect = char_at(&w->word, w->matches);
+			prev = char_at(&w->word, w->matches - 1);
+		}
+		if (key == char_at(&w->word, w->matches)) {
+			hit = true;
 			w->matches += 1;
-			if (w->matches == w->word.len - 1) {
+			if (w->matches == w->word.nchar) {
 				finalize_word(S, w);
-				return;
+				break;
 			}
 		} else {
-			w->matches = key == w->word.data[0];
+			w->matches = key == char_at(&w->word, 0);
+			hit = hit || w->matches;
 		}
 	}
+	if (target == NULL && hit) {
+		/*
+		 * The first character of a word.  A key that starts no word
+		 * was aimed at no word we can tell, so is not counted.
+		 */
+		expect = key;
+		prev = WORD_START;
+	}
+	if (! S->replica) {
+		drill_key(prev, expect, key, t);
+		metrics_key(&S->metrics, hit, t);
+	}
 }
 
 
-/* Process the user keystrokes until signal is received */
+/*
+ * If no keys are pending, wait up to ms milliseconds for one and then
+ * take whatever else the input thread has already read.  Keys are
+ * characters, as their code point, or function keys (KEY_RESIZE and
+ * the like) as their negated curses code, so the two can not be
+ * confused.  Return the number of keys pending.
+ */
+static int
+fill_input(struct state *S, int ms)
+{
+	int key;
+	uint64_t t;
+
+	if (S->input.len == 0 && input_wait(ms)) {
+		S->input.head = 0;
+		while (S->input.len < KEY_BATCH && input_get(&key, &t)) {
+			S->input.t[S->input.len] = t;
+			S->input.key[S->input.len++] = key;
+		}
+	}
+	return S->input.len;
+}
+
+
+/* Return the next pending key, or ERR.  Set *t to the time it was read */
+static int
+next_key(struct state *S, uint64_t *t)
+{
+	if (S->input.len == 0) {
+		return ERR;
+	}
+	S->input.len -= 1;
+	*t = S->input.t[S->input.head];
+	return S->input.key[S->input.head++];
+}
+
+
+/*
+ * Handle a key read at time at.  While a banner is up, only keys that
+ * redraw the screen are handled: the next key answers a banner that
+ * asks a question, and others are held until a timed banner comes
+ * down, or dropped if the game is over by then.
+ */
 static void
-process_keys(struct state *S)
+handle_key(struct state *S, int key, uint64_t at)
 {
-	int  key;
-	while( ((key = getch()) != ERR)) {
-		if (key == CTRL(key)) {
+	if (key == -KEY_RESIZE || key == CTRL('L')) {
+		process_ctrl_key(S, key < 0 ? -key : key);
+	} else if (S->banner.text && S->banner.until == 0) {
+		answer(S, key);
+	} else if (S->banner.text) {
+		if (S->banner.held < KEY_BATCH) {
+			S->banner.key[S->banner.held++] = key;
+		}
+	} else {
+		if (key < 0) {
+			process_ctrl_key(S, -key);
+		} else if (key == CTRL(key)) {
 			process_ctrl_key(S, key);
 		} else {
-			check_matches(S, key);
+			check_matches(S, key, at);
+		}
+		if (S->opponent && key > 0
+			&& (key == CTRL('N') || key != CTRL(key))) {
+			race_send(S->wheel.now, key);
 		}
-		display_words(S);
+	}
+}
+
+
+/* Return the ms to wait for a key before the screen needs attention */
+static int
+input_timeout(struct state *S)
+{
+	int ms = S->frame.dirty ? frame_wait(S) : 1000;
+
+	if (S->wheel.due) {
+		uint64_t now = monotonic_ns();
+		uint64_t left = S->wheel.due > now
+			? (S->wheel.due - now + 999999) / 1000000 : 0;
+
+		ms = left < (uint64_t)ms ? (int)left : ms;
+	}
+	if (S->banner.until) {
+		uint64_t now = monotonic_ns();
+		uint64_t left = S->banner.until > now
+			? (S->banner.until - now + 999999) / 1000000 : 0;
+
+		ms = left < (uint64_t)ms ? (int)left : ms;
+	}
+	return ms;
+}
+
+
+/*
+ * Process the user keystrokes until signal is received.  Keys that
+ * arrive in a burst are all handled before the screen is redrawn
+ * once.  Keys are taken one at a time from the batch, so a banner
+ * raised part way through sees the rest of the batch exactly as it
+ * would have seen them unread on the terminal.
+ */
+static void
+process_keys(struct state *S)
+{
+	int  key;
+	uint64_t at;
+	sig_atomic_t t = tick;
+
+	for (;;) {
+		if (S->banner.until && monotonic_ns() >= S->banner.until) {
+			end_banner(S);
+		}
+		if (fill_input(S, input_timeout(S)) > 0) {
+			while ((key = next_key(S, &at)) != ERR) {
+				handle_key(S, key, at);
+				S->input.keys += 1;
+			}
+			S->frame.dirty = true;
+		} else if (
+			tick != t || ! S->frame.dirty
+			|| (S->wheel.due && monotonic_ns() >= S->wheel.due)
+		) {
+			return;
+		}
+		render(S);
 	}
 }
 
@@ -416,11 +1014,15 @@ process_keys(struct state *S)
 static void
 finalize_word(struct state *S, struct word *w)
 {
-	assert (w->word.data[w->matches] == '\0');
-	S->score.points += w->word.len - 1 + (2 * S->level);
+	assert (char_at(&w->word, w->matches) == '\0');
+	if (! S->replica) {
+		telemetry(EV_WORD, S->level, w->word.nchar + (2 * S->level), 0,
+			w->word.data);
+	}
+	S->score.points += w->word.nchar + (2 * S->level);
 	S->score.words += 1;
-	S->keys.game += w->word.len - 1;
-	S->keys.level += w->word.len - 1;
+	S->keys.game += w->word.nchar;
+	S->keys.level += w->word.nchar;
 	w->killed = 3;
 
 	for (struct word *w = S->words; w != NULL; w = w->next) {
@@ -429,6 +1031,10 @@ finalize_word(struct state *S, struct word *w)
 	if (S->score.words % LEVEL_CHANGE == 0) {
 		if (S->bonus) {
 			S->score.points += 10 * S->level;
+			if (! S->replica) {
+				telemetry(EV_BONUS, S->level, 10 * S->level, 0,
+					NULL);
+			}
 		} else {
 			new_level(S);
 		}
@@ -500,32 +1106,135 @@ garbage_collect(struct state *S)
 		assert(w->killed != 0);
 		w->killed += (w->killed < 0) ? +1 : -1;
 		if (w->killed == 0) {
+			occupy(S, w, -1);
+			unschedule(w);
 			*p = next;
 			w->next = S->free;
 			S->free = w;
+			S->in_play -= 1;
+		}
+	}
+}
+
+
+/*
+ * Advance the game by one tick.  Given the same seed, the same keys
+ * handled between the same ticks give the same game, which is what
+ * lets a race replay the other player's game.
+ */
+static void
+step(struct state *S)
+{
+	maybe_add_word(S);
+	if (move_words(S)) {
+		if (S->bonus) {
+			display_words(S);
+			new_level(S);
 		}
 	}
+	garbage_collect(S);
+}
+
+
+/*
+ * Replay the other game of a race as far as it has been heard from.
+ * Its keys are handled at the ticks at which it handled them.
+ */
+static void
+follow_race(struct state *S)
+{
+	struct state *O = S->opponent;
+	unsigned long at;
+	int key;
+
+	while (race_recv(&at, &key)) {
+		while (O->lives > 0 && O->wheel.now < at) {
+			step(O);
+		}
+		if (O->lives > 0 && key == CTRL(key)) {
+			process_ctrl_key(O, key);
+		} else if (O->lives > 0 && key > 0) {
+			check_matches(O, key, 0);
+		}
+		S->frame.dirty = true;
+	}
+}
+
+
+/*
+ * Return the number of ticks due to be run, by the time since the clock
+ * was started rather than by the SIGALRMs counted: a signal that comes
+ * while another is pending is lost, and the words would fall slower on
+ * a loaded host.  Ticks missed are run late, up to CATCH_UP at once, and
+ * those beyond that are given up, so a long stall does not end with the
+ * words leaping down the screen.
+ */
+static unsigned long
+ticks_due(struct state *S)
+{
+	uint64_t now = monotonic_ns();
+	uint64_t period = S->us_per_tick * 1000ULL;
+	uint64_t n;
+
+	if (S->wheel.due == 0 || now < S->wheel.due) {
+		return 0;
+	}
+	n = (now - S->wheel.due) / period + 1;
+	S->wheel.due += n * period;
+	S->wheel.overruns += n - 1;
+	if (n > CATCH_UP) {
+		S->wheel.dropped += n - CATCH_UP;
+		S->wheel.overruns -= n - CATCH_UP;
+		n = CATCH_UP;
+	}
+	return n;
 }
 
 
 static void
 game(struct state *S)
 {
-	long  i;
+	struct timespec now, logged;
+	unsigned long n;
+	bool over = false;
 
-	while (S->lives > 0) {
-		maybe_add_word(S);
+	clock_gettime(CLOCK_MONOTONIC, &logged);
+	if (! S->banner.text) {
+		S->wheel.due = monotonic_ns() + S->us_per_tick * 1000ULL;
+	}
+	while (! over || S->banner.text) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec - logged.tv_sec >= WPM_LOG_SEC) {
+			update_wpm(S);
+			telemetry(EV_WPM, S->level, S->rates.wpm[M_LEVEL],
+				S->rates.wpm[M_GAME], NULL);
+			logged = now;
+		}
+		if (S->adaptive) {
+			adapt_words(DRILL_SWEEP);
+		}
 
 		process_keys(S);
 
-		if (move_words(S)) {
-			if (S->bonus) {
-				display_words(S);
-				new_level(S);
-			}
+		n = ticks_due(S);
+		for (; n > 0 && S->lives > 0 && ! S->banner.text; n -= 1) {
+			step(S);
+			S->frame.dirty = true;
 		}
-		display_words(S);
-		garbage_collect(S);
+		if (S->passage && passage_done() && S->in_play == 0) {
+			S->lives = 0;  /* the passage has been typed through */
+		}
+		if (S->lives == 0 && ! over) {
+			over = true;
+			display_words(S);
+			banner(S, "Game Over", 3);
+		}
+		if (S->opponent) {
+			race_send(S->wheel.now, -1);
+			follow_race(S);
+		}
+		render(S);
+		live_update(S, monotonic_ns());
 	}
 }
 
@@ -534,24 +1243,30 @@ game(struct state *S)
 static void
 status(struct state *S)
 {
-	attron(A_STANDOUT);
+	if (S->replica) {
+		return;
+	}
+	screen_standout(true);
 	update_wpm(S);
 #define STATUS_WIDTH ( 0\
 	+ sizeof "Score:" + 7 \
 	+ sizeof "Level:" + 3 \
 	+ sizeof "Words:" + 6 \
 	+ sizeof "Lives:" + 3 \
-	+ sizeof "WPM:" + 9 \
+	+ sizeof "WPM:" + 11 \
+	+ sizeof "Acc:" + 4 \
 	)
-	move(0, COLS / 2 - (STATUS_WIDTH / 2));
+	screen_move(0, COLS / 2 - (STATUS_WIDTH / 2));
 #undef STATUS_WIDTH
-	printw("Score: %-7u", S->score.points);
-	printw("Level: %-3u", S->level);
-	printw("Words: %-6u", S->score.words);
-	printw("Lives: %-3d", S->lives);
-	printw("WPM: %4d/%-4d", S->wpm.level, S->wpm.game);
-	clrtoeol();
-	attroff(A_STANDOUT);
+	screen_printf("Score: %-7u", S->score.points);
+	screen_printf("Level: %-3u", S->level);
+	screen_printf("Words: %-6u", S->score.words);
+	screen_printf("Lives: %-3d", S->lives);
+	screen_printf("WPM: %3d/%3d/%-3d ", S->rates.wpm[M_10S],
+		S->rates.wpm[M_LEVEL], S->rates.wpm[M_GAME]);
+	screen_printf("Acc: %3d%%", S->rates.accuracy[M_GAME]);
+	screen_clrtoeol();
+	screen_standout(false);
 }
 
 
@@ -566,41 +1281,10 @@ erase_word_list(struct state *S)
 	}
 }
 
-/* return true iff (e - s ) > N */
-static inline bool
-timeval_span_gt(const struct timeval *e, const struct timeval *s, time_t N)
-{
-	time_t dsec  = e->tv_sec  - s->tv_sec;
-	long   dusec = e->tv_usec - s->tv_usec;
-
-	while (dusec < 0) {
-		dsec  -= 1;
-		dusec += 1E9L;
-	}
-	return dsec > N;
-}
-
-static int
-compute_wpm(const struct timeval *end, const struct timeval *start, int k)
-{
-	struct timeval diff;
-
-	if ( ! timeval_span_gt(end, start, 5)) {
-		return 0;
-	}
-	timersub(end, start, &diff);
-	double minutes = (diff.tv_sec + (diff.tv_usec / 1E6)) / 60.0;
-	return (k / 5) / minutes;
-}
-
 static void
 update_wpm(struct state *S)
 {
-	struct timeval now, diff;
-
-	gettimeofday(&now, NULL);
-	S->wpm.game = compute_wpm(&now, &S->start_time.game, S->keys.game);
-	S->wpm.level = compute_wpm(&now, &S->start_time.level, S->keys.level);
+	metrics_read(&S->metrics, monotonic_ns(), &S->rates);
 }
 
 
@@ -610,8 +1294,14 @@ update_wpm(struct state *S)
 static void
 new_level(struct state *S)
 {
-	update_wpm(S);
-	gettimeofday(&S->start_time.level, NULL);
+	if (! S->replica) {
+		update_wpm(S);
+		if (S->levels_completed > 0) {
+			telemetry(EV_LEVEL_END, S->level, S->rates.wpm[M_LEVEL],
+				S->keys.level, NULL);
+		}
+		metrics_level(&S->metrics, monotonic_ns());
+	}
 	S->keys.level = 0;
 
 	/*
@@ -623,6 +1313,10 @@ new_level(struct state *S)
 		banner(S, "Bonus round finished", 3);
 		erase_word_list(S);
 		status(S);
+		if (! S->replica) {
+			telemetry(EV_LEVEL_START, S->level, S->us_per_tick, 0,
+				NULL);
+		}
 		return;
 	}
 
@@ -635,7 +1329,9 @@ new_level(struct state *S)
 		S->level += 1;
 
 	S->us_per_tick *= S->decay_rate;
-	set_timer(S->us_per_tick / 1000);
+	if (! S->replica) {
+		set_timer(S->us_per_tick / 1000);
+	}
 
 	display_words(S);
 	if (S->score.words && ! ((S->levels_completed - 1) % LVL_PER_BONUS )) {
@@ -644,6 +1340,10 @@ new_level(struct state *S)
 		banner(S, "Prepare for bonus words", 3);
 		S->lives += 1;
 	}
+	if (! S->replica) {
+		telemetry(EV_LEVEL_START, S->level, S->us_per_tick, S->bonus,
+			NULL);
+	}
 }
 
 
@@ -660,18 +1360,35 @@ words_in_play(struct state *S, unsigned N)
 }
 
 
-/* If appropriate, put a new word in play. */
+/*
+ * Put in play the new words due by this tick.  New words come as a
+ * Poisson process in game time: the ticks to the next are drawn from an
+ * exponential distribution as each one comes, with a mean of one over
+ * S->addword or, with -R, over the words a tick that make S->rate a
+ * second at the current speed.  So the rate does not hang on how often
+ * the loop runs, and a word may come part way through a tick's worth of
+ * time.  A word that comes with no slot free is lost.  There are always
+ * at least two words in play.
+ */
 static struct word *
 maybe_add_word(struct state *S)
 {
-	if (! S->free) {
-		return NULL;
-	} else if (! words_in_play(S, 2)) {
-		return add_word(S);
-	} else if ( (double)random() / RAND_MAX < S->addword) {
-		return add_word(S);
+	double mean = S->rate ? S->rate * S->us_per_tick / 1e6 : S->addword;
+	struct word *w = NULL;
+
+	if (S->free && ! words_in_play(S, 2)) {
+		w = add_word(S);
+	}
+	while (S->spawn <= S->wheel.now) {
+		struct word *n = NULL;
+
+		if (S->free && (n = add_word(S)) == NULL) {
+			break;  /* no passage word yet: try again next tick */
+		}
+		S->spawn += -log(1.0 - erand48(S->rng)) / mean;
+		w = n ? n : w;
 	}
-	return NULL;
+	return w;
 }
 
 
@@ -679,20 +1396,43 @@ static struct word *
 add_word(struct state *S)
 {
 	struct word *n = S->free;
-	S->free = n->next;
 	int  len;
+	int  x;
 
-	n->word = S->bonus ? bonusword() : getword();
-	len = n->word.len - 1;
-	n->tick_per_move = len > 6 ? 3 : len > 3 ? 2 : 1;
-	n->tick_mod = tick % n->tick_per_move;
+	n->pos = -1;
+	if (S->bonus) {
+		n->word = bonusword(S->rng);
+	} else if (S->passage) {
+		if (! passage_word(&n->text, &n->word, &n->pos)) {
+			return NULL;  /* the next word has not been read yet */
+		}
+	} else {
+		n->word = getword(&n->text, S->word_rng);
+	}
+	S->free = n->next;
+	S->in_play += 1;
+	len = n->word.nchar;
+	n->period = len > 6 ? 3 : len > 3 ? 2 : 1;
+	n->period *= 0.8 + 0.45 * erand48(S->rng);
+	if (len > 6 && nrand48(S->rng) % 10 == 0) {
+		/* Occasionally a long word comes in fast */
+		n->period *= 0.5;
+	}
+	n->due = S->wheel.now + n->period;
+	n->wprev = NULL;
 	n->matches = 0;
-	n->x = (float)(random() % ((COLS - 1) - (n->word.len - 1)));
+	/* Leave a blank column either side of the word if there is room */
+	fit_grid(S);
+	x = grid_find(&S->grid, 1, n->word.width + 2, S->rng);
+	n->x = x >= 0 ? x + 1
+		: (float)(nrand48(S->rng) % ((S->cols - 1) - n->word.width));
 	n->y = 1;
-	n->lateral = random() % 19 - 9;
+	occupy(S, n, 1);
+	n->lateral = nrand48(S->rng) % 19 - 9;
 	n->next = NULL;
 	n->killed = 0;
-	putword(n);
+	S->frame.dirty = true;
+	schedule(S, n);
 
 	*lastnext(S) = n;
 	return n;
@@ -702,61 +1442,68 @@ static void
 stop_clock(struct state *S)
 {
 	set_timer(0);
-	gettimeofday(&S->start_time.pause, NULL);
+	S->wheel.due = 0;
+	metrics_pause(&S->metrics, monotonic_ns());
 }
 
 static void
 start_clock(struct state *S)
 {
-	struct timeval *g = &S->start_time.game;
-	struct timeval *h = &S->start_time.level;
-	struct timeval *p = &S->start_time.pause;
-
-	if (timerisset(p)) {
-		struct timeval now, diff;
-
-		gettimeofday(&now, NULL);
-		timersub(&now, p, &diff);
-		timeradd(g, &diff, g);
-		timeradd(h, &diff, h);
-		timerclear(p);
-	}
+	uint64_t now = monotonic_ns();
 
+	metrics_resume(&S->metrics, now);
+	S->wheel.due = now + S->us_per_tick * 1000ULL;
 	set_timer(S->us_per_tick / 1000);
 }
 
-/* momentarily display a banner message across the screen */
-static int
+/*
+ * Put a banner message up across the screen, with the clock stopped,
+ * for delay_sec seconds, or if delay_sec is 0, until the next key.
+ * The game loop goes on meanwhile, so the screen is still redrawn
+ * when asked or resized, and brings the banner down when it is due.
+ */
+static void
 banner(struct state *S, const char *text, int delay_sec)
 {
-	int c = ERR;
-	int len = strlen(text);
-	int height = 3;
-	int width = 6 + len;
-	int yposition = LINES / 3;
-	int xposition = (COLS - len) / 2;
-
-	stop_clock(S);
-	WINDOW *boxw = newwin(height, width, yposition, xposition);
-	box(boxw, 0, 0);
-	mvwaddstr(boxw, 1, 3, text);
-	wrefresh(boxw);
-	refresh();
-	if (delay_sec) {
-		sleep(delay_sec);
-		timeout(0);
-		while (getch() != ERR) {
-			;
-		}
-	} else {
-		timeout(-1);
-		c = getch();
+	if (S->replica) {
+		return;
 	}
-	timeout(1000);
-	delwin(boxw);
+	if (S->banner.text == NULL) {
+		stop_clock(S);
+	}
+	screen_popdown(S->banner.window);
+	S->banner.window = screen_popup(text);
+	S->banner.text = text;
+	S->banner.until = delay_sec
+		? monotonic_ns() + delay_sec * (uint64_t)1000000000 : 0;
+	display_words(S);
+}
+
+
+/*
+ * Take the banner down and handle the keys held while it was up, as if
+ * they had been typed as the clock starts again: the times they were
+ * read are in the pause, and would count it in the rates and latencies.
+ */
+static void
+end_banner(struct state *S)
+{
+	int held = S->banner.held;
+	int key[KEY_BATCH];
+	uint64_t now;
+
+	memcpy(key, S->banner.key, held * sizeof *key);
+	screen_popdown(S->banner.window);
+	S->banner.window = NULL;
+	S->banner.text = NULL;
+	S->banner.until = 0;
+	S->banner.held = 0;
 	display_words(S);
 	start_clock(S);
-	return c;
+	now = monotonic_ns();
+	for (int i = 0; i < held && S->lives > 0; i += 1) {
+		handle_key(S, key[i], now);
+	}
 }
 
 
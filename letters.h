@@ -1,14 +1,22 @@
 #include "config.h"
 
+/* Ask curses for its wide character interface */
+#define _XOPEN_SOURCE_EXTENDED 1
+
 #include <assert.h>
 #include <ctype.h>
 #include <curses.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
 #include <math.h>
 #include <pwd.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,6 +26,7 @@
 #include <term.h>
 #include <time.h>
 #include <unistd.h>
+#include <wchar.h>
 
 typedef void *(*reallocator)(void *, size_t);
 
@@ -25,25 +34,70 @@ extern char *score_header;
 
 struct string {
 	char *data;
-	unsigned char len;  /* .len == strlen(.data) - 1 */
+	unsigned char len;    /* .len == strlen(.data) + 1 */
+	unsigned char nchar;  /* number of characters in .data */
+	unsigned short width; /* number of columns .data takes on screen */
+	wchar_t *wide;        /* .data decoded, or NULL if .data is ASCII */
+};
+
+/* Return character i of s */
+static inline int
+char_at(const struct string *s, int i)
+{
+	return s->wide ? (int)s->wide[i] : (unsigned char)s->data[i];
+}
+
+/* most bytes in a word, counting the terminating nul */
+#define MAXWORD 224
+
+/* words per block of a front coded dictionary */
+#define FC_BLOCK 16
+
+/* Room for a word decoded from a front coded dictionary */
+struct wordbuf {
+	char data[MAXWORD];
+	wchar_t wide[MAXWORD];
+};
+
+/* One column of a Walker/Vose alias table */
+struct alias {
+	float prob;      /* probability of keeping the column's own word */
+	unsigned alias;  /* word drawn otherwise */
 };
 
 struct dictionary {
-	struct string *index;
+	struct string *index;  /* the words, or NULL if front coded */
+	const unsigned char *blocks;  /* the words front coded, or NULL */
+	const uint32_t *block;  /* offset in blocks of each block */
+	float *weight;        /* relative frequency of each word, or NULL */
+	struct alias *alias;  /* built from weight; NULL for uniform draws */
+	double *tree;         /* Fenwick tree of adaptive weights, or NULL */
+	float *adapted;       /* current adaptive weight of each word */
+	double total;         /* sum of adapted */
+	size_t sweep;         /* next word to be rescored */
 	size_t cap;
 	size_t len;
+	reallocator r;        /* allocates everything the dictionary owns */
+	struct dictionary *retired;  /* next in the list of those swapped out */
 };
 
+/* A model of a word list, that makes up words like those in it */
+struct markov;
+
 struct word {
 	struct word *next;
+	struct word *wnext;  /* next word in the same timing wheel slot */
+	struct word **wprev; /* link to this word in its slot, or NULL */
 	float x;     /* horizontal coordinate of position */
 	int y;       /* vertical coordinate of position */
-	int tick_per_move;
-	int tick_mod; /* tick in which word entered game */
+	float period; /* ticks per move */
+	double due;  /* tick of the next move, exact however long the game */
 	int matches; /* Length of matching prefix */
 	int killed;  /* word has been marked for deletion */
 	int lateral; /* control lateral motion */
 	struct string word;
+	struct wordbuf text; /* holds word if it came from a front coded list */
+	off_t pos;   /* offset of the word in the passage of -p, or -1 */
 };
 struct score {
 	unsigned points;
@@ -54,44 +108,283 @@ struct score_rec {
 	int	level, words, score;
 };
 
+/* The spans over which typing rates are measured */
+enum metric {
+	M_10S,    /* the last 10 seconds */
+	M_60S,    /* the last minute */
+	M_LEVEL,  /* the current level */
+	M_GAME,   /* the whole game */
+	M_COUNT
+};
+
+#define METRIC_BUCKETS 60
+
+/* Hits and misses over a sliding window, in METRIC_BUCKETS buckets */
+struct window {
+	uint64_t bucket_ns;
+	uint64_t epoch;  /* number of the current bucket */
+	unsigned hit[METRIC_BUCKETS];
+	unsigned miss[METRIC_BUCKETS];
+	unsigned hits;   /* sums over the buckets */
+	unsigned misses;
+};
+
+struct metrics {
+	uint64_t paused;       /* total ns spent paused */
+	uint64_t pause_start;  /* start of the current pause, or 0 */
+	struct window window[M_60S + 1];
+	struct span {
+		uint64_t start;
+		unsigned hits;
+		unsigned misses;
+	} total[M_COUNT];      /* only M_LEVEL and M_GAME are used */
+	int burst;             /* best WPM over 10 seconds */
+};
+
+struct rates {
+	int wpm[M_COUNT];
+	int accuracy[M_COUNT];  /* percent */
+	int burst;              /* best WPM over 10 seconds */
+};
+
+/* Owners of memory, as counted by -M */
+enum subsystem {
+	A_DICTIONARY,
+	A_BONUS,
+	A_SCORES,
+	A_WINDOWS,   /* curses windows for banners */
+	A_SCREEN,
+	A_GRID,      /* cells covered by words */
+	A_COUNT
+};
+
+enum backend {
+	B_CURSES,
+	B_ANSI,    /* escape sequences written directly */
+};
+
+enum event_type {
+	EV_START,       /* session started */
+	EV_LEVEL_START,
+	EV_LEVEL_END,
+	EV_WORD,        /* word completed */
+	EV_MISS,        /* word reached the bottom */
+	EV_WPM,         /* periodic words per minute */
+	EV_BONUS,       /* bonus points awarded */
+	EV_END,         /* game over */
+};
+
+/* Cells of the screen covered by words, with a bitmap per row */
+struct grid {
+	int rows;
+	int cols;
+	int stride;            /* uint64_t words per row of bits */
+	uint64_t *bits;        /* set where count is not zero */
+	unsigned char *count;  /* words covering each cell */
+};
+
+/* A whitespace separated token of a word list */
+struct token {
+	size_t off;  /* offset of the token in the text */
+	size_t len;
+	bool line;   /* the token is the first on its line */
+};
+
+/* least room for tokens that tokenize() may be given */
+#define TOKENS_MIN 33
+
+struct tokenizer {
+	const char *text;
+	size_t len;
+	size_t pos;    /* bytes classified so far */
+	size_t start;  /* start of the token being read */
+	bool in_word;  /* a token has started but not yet ended */
+	bool first;    /* the token being read is the first on its line */
+	bool line;     /* no token has started on the current line */
+};
+
+/* number of slots in the timing wheel that schedules word moves */
+#define WHEEL_SIZE 64
+
+/* most ticks run at once to catch up after the game has fallen behind */
+#define CATCH_UP 8
+
+/* most keys read from the terminal in one burst */
+#define KEY_BATCH 64
+
+/* most words on the screen at once */
+#define WORD_STORE 256
+
+/* The terms of a race, as each game proposes them and as agreed */
+struct race_hello {
+	unsigned rows;    /* screen size */
+	unsigned cols;
+	unsigned level;   /* starting level */
+	uint32_t words;   /* dictionary_fingerprint() */
+	uint32_t seed;
+	uint32_t rate;    /* -R in thousandths of a word a second, or 0 */
+};
+
 struct state {
 	unsigned level;
 	int lives;
 	struct word *words; /* list of words in play */
 	struct word *free; /* list of unused words */
+	unsigned in_play;  /* words taken from the store */
+	struct word store[WORD_STORE];
+	unsigned short rng[3];      /* random numbers for play */
+	unsigned short word_rng[3]; /* random numbers for drawing words */
+	int rows;     /* the size of the screen the words move in */
+	int cols;
+	bool replica; /* a replay of an opponent's game, not shown */
+	struct state *opponent; /* the replay of the game raced, or NULL */
+	struct {
+		struct word *slot[WHEEL_SIZE]; /* words by tick of next move */
+		unsigned long now;  /* last tick processed */
+		uint64_t due;       /* monotonic time of the next tick, or 0 */
+		unsigned long overruns; /* ticks run late, to catch up */
+		unsigned long dropped;  /* ticks given up, past CATCH_UP */
+	} wheel;
+	struct grid grid;   /* screen cells covered by words */
 	struct score score;
 	jmp_buf jbuf;
 	unsigned us_per_tick;  /* micro-seconds pre tick */
 	int levels_completed;
-	struct {
-		struct timeval game;  /* time the game started */
-		struct timeval level; /* time the current level started */
-		struct timeval pause; /* time a pause started */
-	} start_time;
 	struct {
 		unsigned game;
 		unsigned level;
 	} keys;  /* number of keys correctly typed per game/level */
-	struct {
-		int game;
-		int level;
-	} wpm;
+	struct metrics metrics;
+	struct rates rates;
 	bool bonus;   /* true if we're in a bonus round */
+	bool adaptive; /* favor words with the typist's weak bigrams */
+	bool stats;    /* print session statistics at exit */
+	bool pseudo;   /* words are made up by a model of the word list */
+	enum backend backend;
+	struct {
+		int key[KEY_BATCH]; /* keys read but not yet handled */
+		uint64_t t[KEY_BATCH]; /* time each key was read */
+		int head;
+		int len;
+		unsigned long keys;   /* total keys handled by process_keys() */
+	} input;
+	struct {
+		const char *text;     /* message shown over the game, or NULL */
+		uint64_t until;       /* when it comes down; 0 at next key */
+		void *window;         /* from screen_popup() */
+		int held;             /* keys typed while it was up */
+		int key[KEY_BATCH];
+	} banner;
+	struct {
+		bool dirty;           /* the screen is behind the game */
+		unsigned interval_ms; /* minimum time between frames */
+		struct timespec last; /* time the last frame was drawn */
+		unsigned long count;  /* number of frames drawn */
+	} frame;
 	char *dictionary; /* Path to dictionary file */
+	char *log;        /* Path to telemetry log */
 	char *choice; /* String from which to construct random strings */
-	float addword; /* Chance of getting a new word each tick */
+	char *race;   /* Path of the socket to race over */
+	char *live;   /* Path of the file of live counters */
+	char *model;  /* Path to write a model of the word list to */
+	char *passage; /* Path of the passage to type through, or "-" */
+	float addword; /* Mean new words a tick, without -R */
+	double rate;   /* New words a second, from -R, or 0 */
+	double spawn;  /* Tick at which the next new word comes */
 	float decay_rate; /* Per-level increase in speed of game */
 };
 
-struct string bonusword(void);
+void adapt_dictionary(reallocator);
+void alloc_count(bool);
+void alloc_charge(enum subsystem, long long);
+void alloc_report(FILE *);
+unsigned long alloc_total(void);
+reallocator allocator(enum subsystem);
+void adapt_words(unsigned);
+struct string bonusword(unsigned short [3]);
+void collect_dictionaries(void);
+uint32_t dictionary_fingerprint(void);
+void dictionary_unwatch(void);
+void dictionary_watch(const char *);
 int die(const char *fmt, ... ) __attribute__ ((format (printf, 1, 2)));
+void discard_dictionary(struct dictionary *);
+double drill_difficulty(const char *);
+void drill_key(int, int, int, uint64_t);
 void free_dictionaries(void);
-struct string getword(void);
-void initialize_dictionary(char *path, char *, reallocator);
+struct string getword(struct wordbuf *, unsigned short [3]);
+int grid_find(const struct grid *, int, int, unsigned short [3]);
+bool grid_fit(struct grid *, int, int);
+bool grid_free(const struct grid *, int, int, int);
+void grid_mark(struct grid *, int, int, int, int);
+bool input_get(int *, uint64_t *);
+void input_start(void);
+void input_stop(void);
+bool input_wait(int);
+bool initialize_dictionary(char *path, char *, bool, reallocator, reallocator);
+struct dictionary *load_dictionary(const char *, reallocator);
+void live_close(void);
+void live_open(const char *);
+void live_update(const struct state *, uint64_t);
+void markov_add(struct markov *, const struct string *);
+uint32_t markov_fingerprint(const struct markov *);
+bool markov_finish(struct markov *);
+void markov_free(struct markov *);
+struct markov *markov_new(reallocator);
+struct markov *markov_read(const char *, reallocator);
+struct string markov_word(const struct markov *, struct wordbuf *,
+	unsigned short [3]);
+void markov_write(const struct markov *, const char *);
+void measure_string(struct string *, wchar_t *);
+void metrics_key(struct metrics *, bool, uint64_t);
+void metrics_level(struct metrics *, uint64_t);
+void metrics_pause(struct metrics *, uint64_t);
+void metrics_read(struct metrics *, uint64_t, struct rates *);
+void metrics_resume(struct metrics *, uint64_t);
+void metrics_start(struct metrics *, uint64_t);
+uint64_t monotonic_ns(void);
 struct score_rec *next_score(char *, size_t);
+void offer_dictionary(struct dictionary *);
+void passage_close(off_t);
+bool passage_done(void);
+void passage_open(const char *);
+off_t passage_tell(void);
+bool passage_word(struct wordbuf *, struct string *, off_t *);
+bool race_over(void);
+bool race_recv(unsigned long *, int *);
+void race_send(unsigned long, int);
+void race_end(void);
+void race_start(const char *, struct race_hello *, struct race_hello *);
 void redraw(void);
+void save_word_model(const char *);
+void screen_addnstr(const char *, int);
+void screen_addnwstr(const wchar_t *, int);
+enum backend screen_backend(void);
+void screen_clrtoeol(void);
+void screen_end(void);
+void screen_erase(void);
+void screen_init(enum backend, bool);
+void screen_invalidate(void);
+void screen_move(int, int);
+void screen_overlay(void *, int, int, const char *);
+void screen_popdown(void *);
+void *screen_popup(const char *);
+void screen_printf(const char *, ...) __attribute__ ((format (printf, 1, 2)));
+void screen_refresh(void);
+void screen_standout(bool);
+void screen_stats(FILE *);
 void show_scores(struct state *S);
+size_t tokenize(struct tokenizer *, struct token *, size_t);
+const char *tokenize_method(const char *);
+void tokenize_start(struct tokenizer *, const char *, size_t);
+void telemetry(enum event_type, unsigned, long long, long long, const char *);
+void telemetry_close(void);
+void telemetry_open(const char *);
+void trace_done(void);
+void trace_phase(const char *);
+void trace_report(FILE *);
+void trace_startup(const char *);
 void update_scores(struct score *, unsigned);
+char *username(void);
 
 
 /* number of words to be completed before level change */
@@ -107,3 +400,18 @@ void update_scores(struct score *, unsigned);
 
 #define MINSTRING 3
 #define MAXSTRING 8
+
+/* micro-seconds per tick at level 1 */
+#define US_PER_TICK 250000
+
+/* default cap on the redraw rate, in frames per second */
+#define MAX_FPS 30
+
+/* seconds between periodic WPM telemetry events */
+#define WPM_LOG_SEC 5
+
+/* number of words rescored by adapt_words() per pass of the game loop */
+#define DRILL_SWEEP 256
+
+/* the character before the first of a word, for drill_key() */
+#define WORD_START 0
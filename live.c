@@ -0,0 +1,146 @@
+/*
+ * Live counters of a running game, for monitoring.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * With -m, the game maps a small file and keeps in it a row of 64-bit
+ * counters, in the byte order of the host, that any process may read
+ * at any time: a scraper only has to map or read the files of all the
+ * games on a host to see which are falling behind.  The game stores
+ * each counter with a relaxed atomic store once per pass of its loop,
+ * so it never waits on a reader, and a reader sees each counter whole,
+ * though not necessarily all of them from the same pass.
+ *
+ * The file is removed when the game ends.  One left behind by a game
+ * that crashed can be told by its pid, or by a time of update that no
+ * longer moves.
+ */
+
+#include "letters.h"
+
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#define LIVE_MAGIC 0x4c54524cU  /* "LTRL" */
+#define LIVE_VERSION 2
+
+/* The counters, at 8 times their index in the file */
+enum {
+	L_VERSION,      /* LIVE_MAGIC << 32 | LIVE_VERSION */
+	L_PID,
+	L_UPDATED,      /* CLOCK_REALTIME in ns at the last update */
+	L_TICKS,        /* ticks stepped */
+	L_OVERRUNS,     /* ticks run late, to catch up */
+	L_KEYS,         /* keys handled */
+	L_FRAMES,       /* frames drawn */
+	L_WORDS,        /* words in play */
+	L_FREE,         /* free slots for words */
+	L_US_PER_TICK,
+	L_KEYS_PER_SEC, /* over the last whole second */
+	L_FRAMES_PER_SEC,
+	L_LEVEL,
+	L_SCORE,
+	L_DROPPED,      /* ticks given up, too far behind to run */
+	L_COUNT
+};
+
+static struct {
+	_Atomic uint64_t *c;
+	char *path;
+	uint64_t second;      /* start of the second being counted */
+	unsigned long keys;   /* at its start */
+	unsigned long frames;
+} L;
+
+
+static void
+set(int i, uint64_t v)
+{
+	atomic_store_explicit(L.c + i, v, memory_order_relaxed);
+}
+
+
+/*
+ * Keep the counters in the file at path or, if path is a directory, in
+ * a file named for the game's pid in it.
+ */
+void
+live_open(const char *path)
+{
+	struct stat sb;
+	size_t size = L_COUNT * sizeof *L.c;
+	void *p;
+	int fd;
+
+	if (stat(path, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+		size_t n = strlen(path) + sizeof "/letters." + 20;
+
+		if ((L.path = malloc(n)) == NULL) {
+			die("out of memory");
+		}
+		snprintf(L.path, n, "%s/letters.%ld", path, (long)getpid());
+	} else if ((L.path = strdup(path)) == NULL) {
+		die("out of memory");
+	}
+	if (
+		(fd = open(L.path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+			0644)) == -1
+		|| ftruncate(fd, size) == -1
+		|| (p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0)) == MAP_FAILED
+	) {
+		die("%s", L.path);
+	}
+	close(fd);
+	L.c = p;
+	set(L_PID, getpid());
+	set(L_VERSION, (uint64_t)LIVE_MAGIC << 32 | LIVE_VERSION);
+}
+
+
+/* Store the counters of the game, as of monotonic time now */
+void
+live_update(const struct state *S, uint64_t now)
+{
+	struct timespec ts;
+
+	if (L.c == NULL) {
+		return;
+	}
+	if (now - L.second >= 1000000000) {
+		if (L.second) {
+			set(L_KEYS_PER_SEC, S->input.keys - L.keys);
+			set(L_FRAMES_PER_SEC, S->frame.count - L.frames);
+		}
+		L.second = now;
+		L.keys = S->input.keys;
+		L.frames = S->frame.count;
+	}
+	set(L_TICKS, S->wheel.now);
+	set(L_OVERRUNS, S->wheel.overruns);
+	set(L_KEYS, S->input.keys);
+	set(L_FRAMES, S->frame.count);
+	set(L_WORDS, S->in_play);
+	set(L_FREE, WORD_STORE - S->in_play);
+	set(L_US_PER_TICK, S->us_per_tick);
+	set(L_LEVEL, S->level);
+	set(L_SCORE, S->score.points);
+	set(L_DROPPED, S->wheel.dropped);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	set(L_UPDATED, ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+
+void
+live_close(void)
+{
+	if (L.c) {
+		munmap(L.c, L_COUNT * sizeof *L.c);
+		unlink(L.path);
+		L.c = NULL;
+	}
+	free(L.path);
+	L.path = NULL;
+}
@@ -0,0 +1,700 @@
+/*
+ * Load generator for letters.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * letters-loadgen plays a number of games of letters at once, each on
+ * its own pseudo-terminal, to find out how many a host can run before
+ * the games start to stutter.  Each game is run with the ansi backend,
+ * whose output is simple enough to be followed by the small screen
+ * model below, and is played by a synthetic typist who types the
+ * lowest word on the screen at a given rate, getting a given fraction
+ * of the keys wrong.
+ *
+ * Output is read as it comes.  A burst of output (the ansi backend
+ * writes each frame with a single write) is a frame.  The first frame
+ * after a key is taken to be its echo, and the time from the key to
+ * that frame is the echo latency.  Other frames are drawn because
+ * words moved, and so come a whole number of ticks apart.  The tick
+ * is estimated as the median of the last few intervals between them,
+ * and the jitter of an interval is its distance from the nearest
+ * whole number of ticks.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROWS 24
+#define COLS 80
+#define MAX_WORD 64
+#define FRAME_GAP_NS 2000000     /* output closer together is one frame */
+#define QUIT_STEP_NS 300000000   /* time between the keys that end a game */
+#define REAP_NS 3000000000ULL    /* time a game has to exit when asked */
+#define RECENT 15                /* tick intervals used to estimate a tick */
+#define HIST (8 * 40)            /* 8 buckets per power of 2 microseconds */
+
+/* Distribution of times in microseconds, to about 10% */
+struct hist {
+	unsigned long n;
+	uint64_t max;
+	unsigned long count[HIST];
+};
+
+struct session {
+	pid_t pid;
+	int fd;         /* master side of the pty, or -1 once closed */
+	int status;     /* exit status, once reaped */
+	bool reaped;
+	struct rusage ru;
+	uint64_t start;
+	uint64_t end;
+
+	/* what the game has drawn */
+	char screen[ROWS][COLS];
+	int y, x;
+	int esc;        /* state of the escape sequence parser */
+	int param[4];
+	int nparam;
+
+	/* the typist */
+	char target[MAX_WORD];
+	int typed;          /* characters of target typed */
+	uint64_t next_key;
+	uint64_t echo_wait; /* time of the first key not yet echoed, or 0 */
+	int quit;           /* number of the keys that end the game sent */
+
+	/* measurements */
+	uint64_t last_read;
+	uint64_t last_tick;
+	uint64_t recent[RECENT];
+	unsigned nrecent;
+	unsigned long bytes;
+	unsigned long frames;
+	unsigned long keys;
+	unsigned long errors;
+	struct hist echo;
+	struct hist tick;
+	struct hist jitter;
+};
+
+static struct {
+	unsigned sessions;
+	unsigned wpm;
+	double error_rate;
+	unsigned seconds;
+	const char *letters;
+	char **args;
+	int nargs;
+} opt = {
+	.sessions = 10,
+	.wpm = 40,
+	.error_rate = .05,
+	.seconds = 30,
+	.letters = "letters",
+};
+
+static void die(const char *fmt, ...)
+	__attribute__ ((format (printf, 1, 2), noreturn));
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fputs("letters-loadgen: ", stderr);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (fmt[0] && fmt[strlen(fmt) - 1] == ':') {
+		fprintf(stderr, " %s", strerror(errno));
+	}
+	fputc('\n', stderr);
+	exit(EXIT_FAILURE);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+static unsigned
+bucket(uint64_t us)
+{
+	unsigned octave, b;
+
+	if (us < 8) {
+		return us;
+	}
+	octave = 63 - __builtin_clzll(us);
+	b = octave * 8 - 16 + ((us >> (octave - 3)) & 7);
+	return b < HIST ? b : HIST - 1;
+}
+
+/* The smallest time in microseconds that falls in bucket b */
+static uint64_t
+bucket_floor(unsigned b)
+{
+	if (b < 8) {
+		return b;
+	}
+	return (uint64_t)(8 + b % 8) << (b / 8 - 1);
+}
+
+static void
+hist_add(struct hist *h, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+
+	h->n += 1;
+	h->count[bucket(us)] += 1;
+	if (us > h->max) {
+		h->max = us;
+	}
+}
+
+static void
+hist_merge(struct hist *to, const struct hist *from)
+{
+	to->n += from->n;
+	for (int i = 0; i < HIST; i += 1) {
+		to->count[i] += from->count[i];
+	}
+	if (from->max > to->max) {
+		to->max = from->max;
+	}
+}
+
+/* Return the p'th percentile in milliseconds */
+static double
+hist_ms(const struct hist *h, double p)
+{
+	unsigned long want = h->n * p / 100, seen = 0;
+
+	for (int i = 0; i < HIST; i += 1) {
+		seen += h->count[i];
+		if (h->count[i] && seen > want) {
+			return bucket_floor(i) / 1000.0;
+		}
+	}
+	return h->max / 1000.0;
+}
+
+
+static void
+spawn(struct session *s)
+{
+	struct winsize ws = { .ws_row = ROWS, .ws_col = COLS };
+	char *argv[opt.nargs + 4];
+	const char *name;
+	int fd, i = 0;
+
+	argv[i++] = (char *)opt.letters;
+	argv[i++] = "-b";
+	argv[i++] = "ansi";
+	for (int j = 0; j < opt.nargs; j += 1) {
+		argv[i++] = opt.args[j];
+	}
+	argv[i] = NULL;
+
+	if ((fd = posix_openpt(O_RDWR | O_NOCTTY)) == -1
+		|| grantpt(fd) == -1
+		|| unlockpt(fd) == -1
+		|| (name = ptsname(fd)) == NULL
+	) {
+		die("pseudo-terminal:");
+	}
+	switch (s->pid = fork()) {
+	case -1:
+		die("fork:");
+	case 0: {
+		int t;
+		setsid();
+		if ((t = open(name, O_RDWR)) == -1) {
+			perror(name);
+			_exit(127);
+		}
+		ioctl(t, TIOCSCTTY, 0);
+		ioctl(t, TIOCSWINSZ, &ws);
+		dup2(t, STDIN_FILENO);
+		dup2(t, STDOUT_FILENO);
+		dup2(t, STDERR_FILENO);
+		if (t > STDERR_FILENO) {
+			close(t);
+		}
+		close(fd);
+		setenv("TERM", "xterm", 1);
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	s->fd = fd;
+	s->start = now_ns();
+	s->next_key = s->start + 1000000000;  /* let the game draw first */
+	memset(s->screen, ' ', sizeof s->screen);
+}
+
+
+static void
+clear(struct session *s, int y, int from, int to)
+{
+	memset(s->screen[y] + from, ' ', to - from);
+}
+
+/* Apply a CSI sequence ending in c */
+static void
+csi(struct session *s, int c)
+{
+	int a = s->nparam > 0 ? s->param[0] : 0;
+	int b = s->nparam > 1 ? s->param[1] : 0;
+
+	switch (c) {
+	case 'H': case 'f':
+		s->y = (a ? a : 1) - 1;
+		s->x = (b ? b : 1) - 1;
+		break;
+	case 'A': s->y -= a ? a : 1; break;
+	case 'B': s->y += a ? a : 1; break;
+	case 'C': s->x += a ? a : 1; break;
+	case 'D': s->x -= a ? a : 1; break;
+	case 'G': s->x = (a ? a : 1) - 1; break;
+	case 'd': s->y = (a ? a : 1) - 1; break;
+	case 'K':
+		if (s->y >= 0 && s->y < ROWS && s->x < COLS) {
+			clear(s, s->y, a == 0 ? s->x : 0,
+				a == 1 ? s->x + 1 : COLS);
+		}
+		break;
+	case 'J':
+		if (a == 0 && s->x < COLS) {
+			clear(s, s->y, s->x, COLS);
+		}
+		for (int y = a == 0 ? s->y + 1 : 0; y < ROWS; y += 1) {
+			if (y >= 0) {
+				clear(s, y, 0, COLS);
+			}
+		}
+		break;
+	}
+	s->y = s->y < 0 ? 0 : s->y >= ROWS ? ROWS - 1 : s->y;
+	s->x = s->x < 0 ? 0 : s->x > COLS ? COLS : s->x;
+}
+
+/* Follow the game's output on the screen */
+static void
+feed(struct session *s, const char *buf, ssize_t n)
+{
+	for (const unsigned char *p = (const void *)buf; n > 0; p++, n--) {
+		int c = *p;
+		switch (s->esc) {
+		case 0:
+			if (c == '\033') {
+				s->esc = 1;
+			} else if (c == '\r') {
+				s->x = 0;
+			} else if (c == '\n') {
+				s->y += s->y < ROWS - 1;
+			} else if (c == '\b') {
+				s->x -= s->x > 0;
+			} else if (
+				c >= ' ' && c != 0x7f && (c < 0x80 || c >= 0xc0)
+			) {
+				/* a non-ASCII character is a cell to ignore */
+				if (s->x < COLS) {
+					s->screen[s->y][s->x++] =
+						c < 0x80 ? c : '?';
+				}
+			}
+			break;
+		case 1:
+			s->esc = c == '[' ? 2 : c == ']' ? 3
+				: strchr("()*+#", c) ? 4 : 0;
+			s->nparam = 0;
+			s->param[0] = 0;
+			break;
+		case 2:
+			if (isdigit(c)) {
+				if (s->nparam == 0) {
+					s->nparam = 1;
+				}
+				s->param[s->nparam - 1] *= 10;
+				s->param[s->nparam - 1] += c - '0';
+			} else if (c == ';') {
+				if (s->nparam == 0) {
+					s->nparam = 1;
+				}
+				if (s->nparam < 4) {
+					s->param[s->nparam++] = 0;
+				}
+			} else if (c >= 0x40 && c <= 0x7e) {
+				csi(s, c);
+				s->esc = 0;
+			}
+			break;
+		case 3:  /* OSC, ended by BEL or ESC \ */
+			s->esc = c == '\a' ? 0 : c == '\033' ? 1 : 3;
+			break;
+		case 4:
+			s->esc = 0;
+			break;
+		}
+	}
+}
+
+
+static int
+compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Record a burst of output arriving at time t */
+static void
+frame(struct session *s, uint64_t t)
+{
+	uint64_t sorted[RECENT], interval, tick, off;
+	unsigned n;
+
+	s->frames += 1;
+	if (s->echo_wait) {
+		hist_add(&s->echo, t - s->echo_wait);
+		s->echo_wait = 0;
+		return;
+	}
+	if (s->last_tick) {
+		interval = t - s->last_tick;
+		hist_add(&s->tick, interval);
+		s->recent[s->nrecent++ % RECENT] = interval;
+		n = s->nrecent < RECENT ? s->nrecent : RECENT;
+		memcpy(sorted, s->recent, n * sizeof *sorted);
+		qsort(sorted, n, sizeof *sorted, compare);
+		tick = sorted[n / 2];
+		off = interval % tick;
+		hist_add(&s->jitter, off < tick - off ? off : tick - off);
+	}
+	s->last_tick = t;
+}
+
+static void
+drain(struct session *s, uint64_t t)
+{
+	char buf[8192];
+	ssize_t n;
+
+	while ((n = read(s->fd, buf, sizeof buf)) > 0) {
+		if (t - s->last_read > FRAME_GAP_NS) {
+			frame(s, t);
+		}
+		s->last_read = t;
+		s->bytes += n;
+		feed(s, buf, n);
+	}
+	if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+		/* EIO once the game has exited */
+		close(s->fd);
+		s->fd = -1;
+		s->end = t;
+	}
+}
+
+
+/* Choose the word nearest the bottom of the screen */
+static bool
+choose_word(struct session *s)
+{
+	for (int y = ROWS - 1; y > 0; y -= 1) {
+		for (int x = 0; x < COLS; x += 1) {
+			int len = 0;
+			while (
+				x + len < COLS
+				&& isalpha((unsigned char)s->screen[y][x + len])
+			) {
+				len += 1;
+			}
+			if (len > 0 && len < MAX_WORD) {
+				memcpy(s->target, s->screen[y] + x, len);
+				s->target[len] = '\0';
+				s->typed = 0;
+				return true;
+			}
+			x += len;
+		}
+	}
+	return false;
+}
+
+static bool
+on_screen(const struct session *s, const char *word)
+{
+	size_t len = strlen(word);
+
+	for (int y = 1; y < ROWS; y += 1) {
+		for (int x = 0; x + len <= COLS; x += 1) {
+			if (memcmp(s->screen[y] + x, word, len) == 0) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void
+send_key(struct session *s, char c, uint64_t t)
+{
+	if (write(s->fd, &c, 1) == 1) {
+		s->keys += 1;
+		if (! s->echo_wait) {
+			s->echo_wait = t;
+		}
+	}
+}
+
+/* Type the next key, or end the game if its time is up */
+static void
+act(struct session *s, uint64_t t)
+{
+	static const char quit[] = "\003yq";
+	uint64_t gap = 60000000000ULL / (5 * opt.wpm);
+
+	if (s->fd == -1 || t < s->next_key) {
+		return;
+	}
+	if (t - s->start >= opt.seconds * 1000000000ULL) {
+		if (s->quit < (int)sizeof quit - 1) {
+			send_key(s, quit[s->quit++], t);
+			s->next_key = t + QUIT_STEP_NS;
+		} else if (t - s->next_key > REAP_NS) {
+			kill(s->pid, SIGKILL);
+		}
+		return;
+	}
+	s->next_key = t + gap / 2 + lrand48() % gap;
+	if (s->target[0] && ! on_screen(s, s->target)) {
+		s->target[0] = '\0';
+	}
+	/* Wait to see the last word go before looking for the next */
+	if (! s->target[0] && (s->echo_wait || ! choose_word(s))) {
+		return;
+	}
+	if (drand48() < opt.error_rate) {
+		char c = 'a' + lrand48() % 26;
+		if (c == s->target[s->typed]) {
+			c = c == 'z' ? 'a' : c + 1;
+		}
+		send_key(s, c, t);
+		s->errors += 1;
+		return;
+	}
+	send_key(s, s->target[s->typed++], t);
+	if (s->target[s->typed] == '\0') {
+		s->target[0] = '\0';
+	}
+}
+
+static uint64_t
+wake_time(const struct session *s, unsigned n)
+{
+	uint64_t w = UINT64_MAX;
+
+	for (unsigned i = 0; i < n; i += 1) {
+		if (s[i].fd != -1 && s[i].next_key < w) {
+			w = s[i].next_key;
+		}
+	}
+	return w;
+}
+
+static void
+reap(struct session *s, unsigned n, int flags)
+{
+	struct rusage ru;
+	int status;
+	pid_t pid;
+
+	while ((pid = wait4(-1, &status, flags, &ru)) > 0) {
+		for (unsigned i = 0; i < n; i += 1) {
+			if (s[i].pid == pid) {
+				s[i].reaped = true;
+				s[i].status = status;
+				s[i].ru = ru;
+				if (! s[i].end) {
+					s[i].end = now_ns();
+				}
+			}
+		}
+	}
+}
+
+
+static double
+cpu_seconds(const struct rusage *ru)
+{
+	return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6
+		+ ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+static void
+report_line(const char *name, const struct session *s, double cpu, double secs)
+{
+	printf("%-8s %7lu %6lu %5lu"
+		" %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %5.1f\n",
+		name, s->frames, s->keys, s->errors,
+		hist_ms(&s->echo, 50), hist_ms(&s->echo, 99),
+		hist_ms(&s->tick, 50), hist_ms(&s->tick, 99),
+		hist_ms(&s->jitter, 50), hist_ms(&s->jitter, 99),
+		s->jitter.max / 1000.0,
+		secs > 0 ? 100 * cpu / secs : 0.0);
+}
+
+static void
+report(const struct session *s, unsigned n)
+{
+	static struct session all;
+	struct rusage self;
+	double cpu = 0, secs = 0;
+
+	printf("%-8s %7s %6s %5s %13s %13s %20s %5s\n", "", "", "", "",
+		"echo ms", "tick ms", "jitter ms", "");
+	printf("%-8s %7s %6s %5s %6s %6s %6s %6s %6s %6s %6s %5s\n",
+		"session", "frames", "keys", "errs", "p50", "p99",
+		"p50", "p99", "p50", "p99", "max", "cpu%");
+	for (unsigned i = 0; i < n; i += 1) {
+		char name[32];
+		double c = cpu_seconds(&s[i].ru);
+		double t = (s[i].end - s[i].start) / 1e9;
+
+		snprintf(name, sizeof name, "%u%s", i + 1,
+			! s[i].reaped ? "?" :
+			WIFEXITED(s[i].status)
+			&& WEXITSTATUS(s[i].status) == 0 ? "" : "!");
+		report_line(name, s + i, c, t);
+		cpu += c;
+		secs += t;
+		all.frames += s[i].frames;
+		all.keys += s[i].keys;
+		all.errors += s[i].errors;
+		hist_merge(&all.echo, &s[i].echo);
+		hist_merge(&all.tick, &s[i].tick);
+		hist_merge(&all.jitter, &s[i].jitter);
+	}
+	report_line("all", &all, cpu, secs);
+	getrusage(RUSAGE_SELF, &self);
+	printf("%u sessions on %ld cpus: games used %.2f cpu seconds, "
+		"letters-loadgen %.2f\n", n, sysconf(_SC_NPROCESSORS_ONLN),
+		cpu, cpu_seconds(&self));
+}
+
+
+static void
+usage(const char *progname)
+{
+	printf("usage: %s [-n sessions] [-w wpm] [-e error%%] [-t seconds]",
+		progname);
+	puts(" [-p letters] [-- letters-options]\n");
+	puts("option:");
+	puts("  -e     percentage of keys typed wrong (default 5)");
+	puts("  -h     print usage statement");
+	puts("  -n     number of games to run at once (default 10)");
+	puts("  -p     path of the letters program (default letters)");
+	puts("  -t     length of each game in seconds (default 30)");
+	puts("  -w     typing speed in words per minute (default 40)");
+}
+
+int
+main(int argc, char **argv)
+{
+	static char *defaults[] = { "-s", "abcdefghijklmnopqrstuvwxyz" };
+	struct session *s;
+	struct pollfd *pfd;
+	unsigned live;
+	int c;
+
+	while ((c = getopt(argc, argv, "e:hn:p:t:w:")) != -1) {
+		switch (c) {
+		case 'e': opt.error_rate = strtod(optarg, NULL) / 100; break;
+		case 'n': opt.sessions = strtoul(optarg, NULL, 10); break;
+		case 'p': opt.letters = optarg; break;
+		case 't': opt.seconds = strtoul(optarg, NULL, 10); break;
+		case 'w': opt.wpm = strtoul(optarg, NULL, 10); break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (opt.sessions == 0 || opt.wpm == 0) {
+		die("sessions and wpm must be positive");
+	}
+	/* Random strings by default, so no high scores are written */
+	opt.args = optind < argc ? argv + optind : defaults;
+	opt.nargs = optind < argc ? argc - optind : 2;
+
+	signal(SIGPIPE, SIG_IGN);
+	srand48(getpid());
+	if ((s = calloc(opt.sessions, sizeof *s)) == NULL
+		|| (pfd = calloc(opt.sessions, sizeof *pfd)) == NULL
+	) {
+		die("out of memory");
+	}
+	for (unsigned i = 0; i < opt.sessions; i += 1) {
+		spawn(s + i);
+	}
+
+	do {
+		uint64_t t = now_ns(), w = wake_time(s, opt.sessions);
+		int ms = w <= t ? 0 : w - t > 100000000 ? 100
+			: (w - t + 999999) / 1000000;
+
+		for (unsigned i = 0; i < opt.sessions; i += 1) {
+			pfd[i].fd = s[i].fd;
+			pfd[i].events = POLLIN;
+		}
+		if (poll(pfd, opt.sessions, ms) == -1 && errno != EINTR) {
+			die("poll:");
+		}
+		t = now_ns();
+		live = 0;
+		for (unsigned i = 0; i < opt.sessions; i += 1) {
+			if (s[i].fd != -1 && pfd[i].revents) {
+				drain(s + i, t);
+			}
+			act(s + i, t);
+			live += s[i].fd != -1;
+		}
+		reap(s, opt.sessions, WNOHANG);
+	} while (live > 0);
+	reap(s, opt.sessions, 0);
+
+	report(s, opt.sessions);
+	return 0;
+}
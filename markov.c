@@ -0,0 +1,440 @@
+/*
+ * Make up pronounceable words from a model of a word list.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * The model gives, for each pair of characters, how often each
+ * character follows it in the words of the list, counting the start
+ * and end of a word as a character of its own.  A word is made up by
+ * drawing each character in proportion to how often it follows the
+ * two before it, from the start until the end is drawn, so words look
+ * like those of the list without being taken from it.
+ *
+ * The characters of the list are numbered in the order they are first
+ * seen, 0 being the start or end of a word, so the model can only hold
+ * lists of fewer than 256 different characters: words with characters
+ * past that are left out of it.  While the model is trained the counts
+ * are kept in a hash table keyed by the three characters; once it is
+ * finished they are packed into a sorted array of the pairs seen, each
+ * with the range of its followers in an array of the characters and
+ * their cumulative counts.  For an English word list this comes to a
+ * few tens of kilobytes, against megabytes for the list.
+ *
+ * A model may be written to a file and read back: an 8 byte magic
+ * number, a check of the byte order, the sizes of the arrays, and the
+ * arrays, in the byte order of the host that wrote it.
+ */
+
+#include "letters.h"
+
+#define MAGIC "letters\x01"
+#define BYTE_ORDER_MARK 0x01020304
+#define SYMBOLS 256
+#define PSEUDO_MIN 3    /* fewest characters in a made up word */
+#define PSEUDO_MAX 24   /* and most */
+#define TRIES 16        /* to make a word of a length between them */
+
+struct markov {
+	unsigned nsym;      /* characters, with 0 the start or end of words */
+	uint32_t nctx;      /* pairs of characters seen */
+	uint32_t nedge;     /* characters seen following them */
+	uint32_t *sym;      /* each character */
+	uint16_t *ctx;      /* pairs, as first << 8 | second, in order */
+	uint32_t *first;    /* edges of ctx[i] are first[i] to first[i + 1] */
+	unsigned char *next;  /* character of each edge */
+	uint32_t *cum;      /* and the counts of the pair's edges up to it */
+	reallocator r;
+
+	/* while training */
+	uint32_t *key;      /* first << 16 | second << 8 | next, plus 1 */
+	uint32_t *count;
+	size_t cap;         /* a power of 2 */
+	size_t used;
+	uint32_t symkey[2 * SYMBOLS];  /* hash of characters, plus 1 */
+	unsigned char symval[2 * SYMBOLS];
+};
+
+
+static void *
+grow(reallocator r, void *p, size_t size)
+{
+	if ((p = r(p, size)) == NULL && size > 0) {
+		perror("out of memory");
+		exit(1);
+	}
+	return p;
+}
+
+
+struct markov *
+markov_new(reallocator r)
+{
+	struct markov *m = grow(r, NULL, sizeof *m);
+
+	memset(m, 0, sizeof *m);
+	m->r = r;
+	m->nsym = 1;
+	m->sym = grow(r, NULL, SYMBOLS * sizeof *m->sym);
+	m->sym[0] = 0;
+	return m;
+}
+
+
+/* Return the number of character c, numbering it if it is new, or 0 */
+static unsigned
+symbol(struct markov *m, uint32_t c)
+{
+	size_t i = (c * 2654435761u) % (2 * SYMBOLS);
+
+	for (; m->symkey[i]; i = (i + 1) % (2 * SYMBOLS)) {
+		if (m->symkey[i] == c + 1) {
+			return m->symval[i];
+		}
+	}
+	if (m->nsym == SYMBOLS) {
+		return 0;
+	}
+	m->symkey[i] = c + 1;
+	m->sym[m->nsym] = c;
+	return m->symval[i] = m->nsym++;
+}
+
+
+static void
+count(struct markov *m, uint32_t key)
+{
+	size_t i;
+
+	if (2 * (m->used + 1) > m->cap) {
+		uint32_t *key = m->key, *n = m->count;
+		size_t cap = m->cap;
+
+		m->cap = cap ? 2 * cap : 4096;
+		m->key = grow(m->r, NULL, m->cap * sizeof *m->key);
+		m->count = grow(m->r, NULL, m->cap * sizeof *m->count);
+		memset(m->key, 0, m->cap * sizeof *m->key);
+		m->used = 0;
+		for (i = 0; i < cap; i += 1) {
+			if (key[i]) {
+				size_t j = key[i] * 2654435761u & (m->cap - 1);
+
+				while (m->key[j]) {
+					j = (j + 1) & (m->cap - 1);
+				}
+				m->key[j] = key[i];
+				m->count[j] = n[i];
+				m->used += 1;
+			}
+		}
+		m->r(key, 0);
+		m->r(n, 0);
+	}
+	key += 1;
+	i = (key * 2654435761u) & (m->cap - 1);
+	for (; m->key[i]; i = (i + 1) & (m->cap - 1)) {
+		if (m->key[i] == key) {
+			m->count[i] += 1;
+			return;
+		}
+	}
+	m->key[i] = key;
+	m->count[i] = 1;
+	m->used += 1;
+}
+
+
+/* Count the characters of s, unless it has too many different ones */
+void
+markov_add(struct markov *m, const struct string *s)
+{
+	unsigned char c[MAXWORD + 1];
+	unsigned a = 0, b = 0;
+
+	for (int i = 0; i < s->nchar; i += 1) {
+		if ((c[i] = symbol(m, char_at(s, i))) == 0) {
+			return;
+		}
+	}
+	c[s->nchar] = 0;
+	for (int i = 0; i <= s->nchar; i += 1) {
+		count(m, a << 16 | b << 8 | c[i]);
+		a = b;
+		b = c[i];
+	}
+}
+
+
+static int
+by_key(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/*
+ * Pack the counts, which can not be added to after this.  Return false
+ * if no word was counted.
+ */
+bool
+markov_finish(struct markov *m)
+{
+	uint64_t *e = grow(m->r, NULL, (m->used + 1) * sizeof *e);
+	size_t n = 0;
+
+	for (size_t i = 0; i < m->cap; i += 1) {
+		if (m->key[i]) {
+			e[n++] = (uint64_t)(m->key[i] - 1) << 32 | m->count[i];
+		}
+	}
+	qsort(e, n, sizeof *e, by_key);
+	m->next = grow(m->r, NULL, n + 1);
+	m->cum = grow(m->r, NULL, (n + 1) * sizeof *m->cum);
+	m->ctx = grow(m->r, NULL, (n + 1) * sizeof *m->ctx);
+	m->first = grow(m->r, NULL, (n + 2) * sizeof *m->first);
+	m->nctx = 0;
+	for (size_t i = 0; i < n; i += 1) {
+		uint16_t ctx = e[i] >> 40;
+
+		if (i == 0 || ctx != m->ctx[m->nctx - 1]) {
+			m->ctx[m->nctx] = ctx;
+			m->first[m->nctx++] = i;
+		}
+		m->next[i] = e[i] >> 32 & 0xff;
+		m->cum[i] = (uint32_t)e[i]
+			+ (i > m->first[m->nctx - 1] ? m->cum[i - 1] : 0);
+	}
+	m->first[m->nctx] = m->nedge = n;
+	m->r(e, 0);
+	m->r(m->key, 0);
+	m->r(m->count, 0);
+	m->key = m->count = NULL;
+	m->cap = m->used = 0;
+	return n > 0;
+}
+
+
+/* Draw the character to follow the pair ctx, or 0 if it was never seen */
+static unsigned
+draw(const struct markov *m, unsigned ctx, unsigned short rng[3])
+{
+	size_t lo = 0, hi = m->nctx;
+	uint32_t u;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (m->ctx[mid] < ctx) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == m->nctx || m->ctx[lo] != ctx) {
+		return 0;
+	}
+	u = nrand48(rng) % m->cum[m->first[lo + 1] - 1];
+	for (lo = m->first[lo]; m->cum[lo] <= u; lo += 1) {
+		;
+	}
+	return m->next[lo];
+}
+
+
+/* Make up a word with the random number stream rng, in buf */
+struct string
+markov_word(const struct markov *m, struct wordbuf *buf,
+	unsigned short rng[3])
+{
+	struct string s = { .data = buf->data, .wide = buf->wide };
+	bool ascii = true;
+	mbstate_t st;
+	size_t len = 0;
+	int n = 0;
+
+	for (int t = 0; t < TRIES; t += 1) {
+		unsigned a = 0, b = 0, c;
+
+		for (n = 0; n < PSEUDO_MAX; ) {
+			if ((c = draw(m, a << 8 | b, rng)) == 0) {
+				break;
+			}
+			buf->wide[n++] = m->sym[c];
+			a = b;
+			b = c;
+		}
+		if (n >= PSEUDO_MIN && n < PSEUDO_MAX) {
+			break;
+		}
+	}
+	memset(&st, 0, sizeof st);
+	for (int i = 0; i < n; i += 1) {
+		size_t k = wcrtomb(buf->data + len, buf->wide[i], &st);
+		int w = wcwidth(buf->wide[i]);
+
+		if (k == (size_t)-1) {
+			buf->data[len] = '?';
+			k = 1;
+			memset(&st, 0, sizeof st);
+		}
+		len += k;
+		s.width += w < 0 ? 1 : w;
+		ascii = ascii && buf->wide[i] < 0x80;
+	}
+	buf->data[len] = '\0';
+	buf->wide[n] = L'\0';
+	s.len = len + 1;
+	s.nchar = n;
+	if (ascii) {
+		s.wide = NULL;
+	}
+	return s;
+}
+
+
+/* Return a hash of the model, to tell whether two games share it */
+uint32_t
+markov_fingerprint(const struct markov *m)
+{
+	uint32_t h = 2166136261u;  /* FNV-1a */
+
+	for (unsigned i = 0; i < m->nsym; i += 1) {
+		h = (h ^ m->sym[i]) * 16777619u;
+	}
+	for (uint32_t i = 0; i < m->nedge; i += 1) {
+		h = (h ^ m->next[i]) * 16777619u;
+		h = (h ^ m->cum[i]) * 16777619u;
+	}
+	return h;
+}
+
+
+void
+markov_write(const struct markov *m, const char *path)
+{
+	uint32_t head[] = { BYTE_ORDER_MARK, m->nsym, m->nctx, m->nedge };
+	FILE *fp = fopen(path, "w");
+
+	if (
+		fp == NULL
+		|| fwrite(MAGIC, 8, 1, fp) != 1
+		|| fwrite(head, sizeof head, 1, fp) != 1
+		|| fwrite(m->sym, sizeof *m->sym, m->nsym, fp) != m->nsym
+		|| fwrite(m->ctx, sizeof *m->ctx, m->nctx, fp) != m->nctx
+		|| fwrite(m->first, sizeof *m->first, m->nctx + 1, fp)
+			!= m->nctx + 1
+		|| fwrite(m->next, 1, m->nedge, fp) != m->nedge
+		|| fwrite(m->cum, sizeof *m->cum, m->nedge, fp) != m->nedge
+		|| fclose(fp) != 0
+	) {
+		die("%s", path);
+	}
+}
+
+
+/* Check that the model read from path can be drawn from safely */
+static void
+check(const struct markov *m, const char *path)
+{
+	for (uint32_t i = 0; i < m->nctx; i += 1) {
+		if (
+			(i > 0 && m->ctx[i] <= m->ctx[i - 1])
+			|| m->first[i] >= m->first[i + 1]
+		) {
+			goto bad;
+		}
+		for (uint32_t k = m->first[i]; k < m->first[i + 1]; k += 1) {
+			if (
+				m->next[k] >= m->nsym
+				|| (k > m->first[i]
+					&& m->cum[k] <= m->cum[k - 1])
+				|| m->cum[k] == 0
+			) {
+				goto bad;
+			}
+		}
+	}
+	if (m->nctx == 0 || m->first[0] != 0 || m->first[m->nctx] != m->nedge) {
+		goto bad;
+	}
+	return;
+bad:
+	errno = 0;
+	die("%s: damaged word model", path);
+}
+
+
+/*
+ * Read a model written by markov_write() from path.  Return NULL if
+ * path can not be opened or does not hold a model.
+ */
+struct markov *
+markov_read(const char *path, reallocator r)
+{
+	FILE *fp = fopen(path, "r");
+	char magic[8];
+	uint32_t head[4];
+	struct markov *m;
+
+	if (fp == NULL) {
+		return NULL;
+	}
+	if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, MAGIC, 8) != 0) {
+		fclose(fp);
+		return NULL;
+	}
+	if (
+		fread(head, sizeof head, 1, fp) != 1
+		|| head[0] != BYTE_ORDER_MARK
+		|| head[1] == 0 || head[1] > SYMBOLS
+		|| head[2] > SYMBOLS * SYMBOLS
+		|| head[3] > (uint64_t)head[2] * SYMBOLS
+	) {
+		errno = 0;
+		die("%s: damaged word model, or one from another kind of host",
+			path);
+	}
+	m = markov_new(r);
+	m->nsym = head[1];
+	m->nctx = head[2];
+	m->nedge = head[3];
+	m->ctx = grow(r, NULL, (m->nctx + 1) * sizeof *m->ctx);
+	m->first = grow(r, NULL, (m->nctx + 1) * sizeof *m->first);
+	m->next = grow(r, NULL, m->nedge + 1);
+	m->cum = grow(r, NULL, (m->nedge + 1) * sizeof *m->cum);
+	if (
+		fread(m->sym, sizeof *m->sym, m->nsym, fp) != m->nsym
+		|| fread(m->ctx, sizeof *m->ctx, m->nctx, fp) != m->nctx
+		|| fread(m->first, sizeof *m->first, m->nctx + 1, fp)
+			!= m->nctx + 1
+		|| fread(m->next, 1, m->nedge, fp) != m->nedge
+		|| fread(m->cum, sizeof *m->cum, m->nedge, fp) != m->nedge
+	) {
+		errno = 0;
+		die("%s: damaged word model", path);
+	}
+	fclose(fp);
+	check(m, path);
+	return m;
+}
+
+
+void
+markov_free(struct markov *m)
+{
+	if (m) {
+		reallocator r = m->r;
+
+		r(m->sym, 0);
+		r(m->ctx, 0);
+		r(m->first, 0);
+		r(m->next, 0);
+		r(m->cum, 0);
+		r(m->key, 0);
+		r(m->count, 0);
+		r(m, 0);
+	}
+}
@@ -0,0 +1,201 @@
+/*
+ * Typing speed and accuracy for letters.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * Every key is recorded, with the time it was read, as a hit (it
+ * extended some word) or a miss.  The last 10 and 60 seconds are kept
+ * as rings of METRIC_BUCKETS buckets with running totals, so recording
+ * a key and reading a rate are both O(1) (amortized over the buckets
+ * that expire).  The level and the game are plain running totals.
+ *
+ * All times are on CLOCK_MONOTONIC, less any time spent paused, so
+ * neither wall clock adjustments nor banners distort the rates.
+ */
+
+#include "letters.h"
+
+/* Rates are not computed over less than this, to avoid wild values */
+#define MIN_SPAN_NS 1000000000ULL
+
+static const uint64_t window_span[] = {
+	[M_10S] = 10000000000ULL,
+	[M_60S] = 60000000000ULL,
+};
+
+
+uint64_t
+monotonic_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+
+/* Convert a monotonic time into metric time, which stops while paused */
+static uint64_t
+metric_time(const struct metrics *M, uint64_t t)
+{
+	if (M->pause_start && t > M->pause_start) {
+		t = M->pause_start;
+	}
+	return t - M->paused;
+}
+
+
+/*
+ * Expire the buckets of w that are older than the window at time t.  A
+ * time before the current bucket, as of a key read before the window
+ * was last advanced, leaves the window as it is, and the key is counted
+ * in the current bucket.
+ */
+static void
+advance(struct window *w, uint64_t t)
+{
+	uint64_t b = t / w->bucket_ns;
+
+	if (b <= w->epoch) {
+		return;
+	}
+	if (b - w->epoch >= METRIC_BUCKETS) {
+		memset(w->hit, 0, sizeof w->hit);
+		memset(w->miss, 0, sizeof w->miss);
+		w->hits = w->misses = 0;
+		w->epoch = b;
+	}
+	while (w->epoch < b) {
+		int i = ++w->epoch % METRIC_BUCKETS;
+		w->hits -= w->hit[i];
+		w->misses -= w->miss[i];
+		w->hit[i] = w->miss[i] = 0;
+	}
+}
+
+
+/* Words (of 5 characters) per minute */
+static int
+wpm(unsigned hits, uint64_t span)
+{
+	if (span < MIN_SPAN_NS) {
+		span = MIN_SPAN_NS;
+	}
+	return hits * 12e9 / span;
+}
+
+
+void
+metrics_start(struct metrics *M, uint64_t t)
+{
+	memset(M, 0, sizeof *M);
+	for (int i = M_10S; i <= M_60S; i += 1) {
+		M->window[i].bucket_ns = window_span[i] / METRIC_BUCKETS;
+	}
+	t = metric_time(M, t);
+	for (int i = M_10S; i <= M_60S; i += 1) {
+		M->window[i].epoch = t / M->window[i].bucket_ns;
+	}
+	M->total[M_LEVEL].start = M->total[M_GAME].start = t;
+}
+
+
+void
+metrics_level(struct metrics *M, uint64_t t)
+{
+	M->total[M_LEVEL].start = metric_time(M, t);
+	M->total[M_LEVEL].hits = M->total[M_LEVEL].misses = 0;
+}
+
+
+void
+metrics_key(struct metrics *M, bool hit, uint64_t t)
+{
+	t = metric_time(M, t);
+	for (int i = M_10S; i <= M_60S; i += 1) {
+		struct window *w = M->window + i;
+		int b;
+
+		advance(w, t);
+		b = w->epoch % METRIC_BUCKETS;
+		if (hit) {
+			w->hit[b] += 1;
+			w->hits += 1;
+		} else {
+			w->miss[b] += 1;
+			w->misses += 1;
+		}
+	}
+	for (int i = M_LEVEL; i <= M_GAME; i += 1) {
+		if (hit) {
+			M->total[i].hits += 1;
+		} else {
+			M->total[i].misses += 1;
+		}
+	}
+	if (hit) {
+		uint64_t span = t - M->total[M_GAME].start;
+		int burst;
+
+		if (span > window_span[M_10S]) {
+			span = window_span[M_10S];
+		}
+		burst = wpm(M->window[M_10S].hits, span);
+		if (burst > M->burst) {
+			M->burst = burst;
+		}
+	}
+}
+
+
+void
+metrics_pause(struct metrics *M, uint64_t t)
+{
+	if (! M->pause_start) {
+		M->pause_start = t;
+	}
+}
+
+
+void
+metrics_resume(struct metrics *M, uint64_t t)
+{
+	if (M->pause_start) {
+		M->paused += t - M->pause_start;
+		M->pause_start = 0;
+	}
+}
+
+
+static int
+accuracy(unsigned hits, unsigned misses)
+{
+	return hits + misses ? 100 * hits / (hits + misses) : 100;
+}
+
+
+void
+metrics_read(struct metrics *M, uint64_t t, struct rates *r)
+{
+	t = metric_time(M, t);
+	for (int i = M_10S; i <= M_60S; i += 1) {
+		struct window *w = M->window + i;
+		uint64_t span = t - M->total[M_GAME].start;
+
+		advance(w, t);
+		if (span > window_span[i]) {
+			span = window_span[i];
+		}
+		r->wpm[i] = wpm(w->hits, span);
+		r->accuracy[i] = accuracy(w->hits, w->misses);
+	}
+	for (int i = M_LEVEL; i <= M_GAME; i += 1) {
+		struct span *s = M->total + i;
+
+		r->wpm[i] = wpm(s->hits, t - s->start);
+		r->accuracy[i] = accuracy(s->hits, s->misses);
+	}
+	r->burst = M->burst;
+}
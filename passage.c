@@ -0,0 +1,364 @@
+/*
+ * Deal the words of a passage in order, for -p.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * A reader thread reads the passage into two buffers in turn, while
+ * the game deals words from the other, so the game never waits on the
+ * file and the memory used is the same however long the passage is.
+ * Each buffer holds only whole words: what is left of a word at the
+ * end of a read is carried over to the start of the next buffer.  The
+ * reader waits on a semaphore for a buffer to be given back; the game
+ * only ever tests whether the next one is full, and if it is not, no
+ * word is dealt on that tick.
+ *
+ * Words are cut into pieces of at most PIECE bytes, at a character
+ * boundary, so a long line of code with no spaces still fits on the
+ * screen.
+ *
+ * The offset in the file of the first word not yet typed is kept in
+ * ~/.letters.pos, by the real path of the file, and the next game of
+ * the same file starts there.  A passage read from standard input has
+ * no position to keep.
+ */
+
+#include "letters.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#define BUF_SIZE 65536
+#define PIECE 32
+#define TOKENS 64    /* tokens cut from a buffer at a time */
+#define POS_FILE ".letters.pos"
+
+struct buffer {
+	char data[BUF_SIZE];
+	size_t len;
+	off_t pos;       /* offset in the file of data[0] */
+	bool end;        /* the passage ends with this buffer */
+};
+
+static struct {
+	struct buffer buf[2];
+	atomic_bool full[2];
+	sem_t empty;     /* buffers the reader may fill */
+	pthread_t reader;
+	bool running;
+	int fd;
+	off_t at;        /* offset of the next byte to be read */
+	char *path;      /* real path, or NULL for standard input */
+
+	/* the game's side */
+	off_t next;      /* offset of the buffer to be dealt from next */
+	int cur;         /* buffer being dealt from */
+	bool dealing;    /* cur is being dealt from */
+	bool done;       /* every word has been dealt */
+	struct tokenizer t;
+	struct token tok[TOKENS];
+	size_t ntok;
+	size_t itok;
+	size_t cut;      /* bytes of tok[itok] already dealt */
+} P = { .fd = -1 };
+
+
+/* Return the path of the file of positions, or NULL */
+static char *
+pos_path(void)
+{
+	const char *home = getenv("HOME");
+	static char path[PATH_MAX];
+
+	if (home == NULL || *home == '\0'
+			|| snprintf(path, sizeof path, "%s/" POS_FILE, home)
+			>= (int)sizeof path) {
+		return NULL;
+	}
+	return path;
+}
+
+
+/* Return the offset saved for the passage, or 0 */
+static off_t
+saved_pos(void)
+{
+	char *path = pos_path();
+	FILE *fp = path ? fopen(path, "r") : NULL;
+	char line[PATH_MAX + 32];
+	off_t pos = 0;
+
+	if (fp == NULL) {
+		return 0;
+	}
+	while (fgets(line, sizeof line, fp)) {
+		char *end;
+		long long v = strtoll(line, &end, 10);
+
+		line[strcspn(line, "\n")] = '\0';
+		if (*end == ' ' && strcmp(end + 1, P.path) == 0) {
+			pos = v;
+		}
+	}
+	fclose(fp);
+	return pos;
+}
+
+
+/* Save pos as the offset of the passage, keeping those of others */
+static void
+save_pos(off_t pos)
+{
+	char *path = pos_path();
+	char tmp[PATH_MAX + 8];
+	char line[PATH_MAX + 32];
+	FILE *in, *out;
+
+	if (path == NULL || P.path == NULL) {
+		return;
+	}
+	snprintf(tmp, sizeof tmp, "%s.new", path);
+	if ((out = fopen(tmp, "w")) == NULL) {
+		perror(tmp);
+		return;
+	}
+	if ((in = fopen(path, "r")) != NULL) {
+		while (fgets(line, sizeof line, in)) {
+			char *sp = strchr(line, ' ');
+
+			line[strcspn(line, "\n")] = '\0';
+			if (sp == NULL || strcmp(sp + 1, P.path) != 0) {
+				fprintf(out, "%s\n", line);
+			}
+		}
+		fclose(in);
+	}
+	fprintf(out, "%lld %s\n", (long long)pos, P.path);
+	if (fclose(out) || rename(tmp, path)) {
+		perror(path);
+	}
+}
+
+
+/* Read into b, after the carry of n bytes, at least one whole word */
+static void
+fill(struct buffer *b, size_t n)
+{
+	b->end = false;
+	for (;;) {
+		ssize_t k = read(P.fd, b->data + n, BUF_SIZE - n);
+		size_t keep;
+
+		if (k == -1 && errno == EINTR) {
+			continue;
+		}
+		if (k <= 0) {
+			b->end = true;
+			b->len = n;
+			return;
+		}
+		P.at += k;
+		n += k;
+		/* keep up to the last whitespace, unless the buffer is full */
+		for (keep = n; keep > 0; keep -= 1) {
+			if (isspace((unsigned char)b->data[keep - 1])) {
+				break;
+			}
+		}
+		if (keep > 0 || n == BUF_SIZE) {
+			b->len = keep > 0 ? keep : n;
+			return;
+		}
+	}
+}
+
+
+static void *
+reader(void *arg)
+{
+	int i = 0;
+	size_t carry = 0;
+
+	while (sem_wait(&P.empty) == 0 || errno == EINTR) {
+		struct buffer *b = P.buf + i;
+		struct buffer *prev = P.buf + (i ^ 1);
+
+		/* The other buffer is being dealt from, but its carry is not */
+		memcpy(b->data, prev->data + prev->len, carry);
+		b->pos = P.at - carry;
+		fill(b, carry);
+		carry = b->end ? 0 : P.at - (b->pos + b->len);
+		atomic_store_explicit(P.full + i, true, memory_order_release);
+		if (b->end) {
+			break;
+		}
+		i ^= 1;
+	}
+	return arg;
+}
+
+
+/*
+ * Deal the words of the passage at path, or of standard input if path
+ * is "-", from where the last game of it stopped.
+ */
+void
+passage_open(const char *path)
+{
+	sigset_t all, old;
+	char real[PATH_MAX];
+	struct stat sb;
+	off_t pos;
+
+	if (strcmp(path, "-") == 0) {
+		int tty = -1;
+
+		/* The keys must still come from the terminal */
+		if ((P.fd = dup(STDIN_FILENO)) == -1
+				|| (tty = open("/dev/tty", O_RDWR)) == -1
+				|| dup2(tty, STDIN_FILENO) == -1) {
+			die("-p -");
+		}
+		close(tty);
+	} else {
+		if ((P.fd = open(path, O_RDONLY | O_CLOEXEC)) == -1
+				|| realpath(path, real) == NULL
+				|| (P.path = strdup(real)) == NULL) {
+			die("%s", path);
+		}
+		/* A passage cut short since is started again at the top */
+		if (
+			(pos = saved_pos()) > 0 && fstat(P.fd, &sb) == 0
+			&& pos < sb.st_size && lseek(P.fd, pos, SEEK_SET) == pos
+		) {
+			P.at = P.next = pos;
+		}
+	}
+	sem_init(&P.empty, 0, 2);
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&P.reader, NULL, reader, NULL)) {
+		die("pthread_create");
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	P.running = true;
+}
+
+
+/* Give the buffer dealt from back to the reader */
+static void
+release(void)
+{
+	atomic_store_explicit(P.full + P.cur, false, memory_order_relaxed);
+	P.done = P.buf[P.cur].end;
+	P.next = P.buf[P.cur].pos + P.buf[P.cur].len;
+	P.dealing = false;
+	P.cur ^= 1;
+	sem_post(&P.empty);
+}
+
+
+/*
+ * Put the next word of the passage in buf, and its offset in the file
+ * in pos, and return true, or return false if none has been read yet.
+ */
+bool
+passage_word(struct wordbuf *buf, struct string *s, off_t *pos)
+{
+	while (! P.done) {
+		struct buffer *b = P.buf + P.cur;
+
+		if (! P.dealing) {
+			if (! atomic_load_explicit(P.full + P.cur,
+					memory_order_acquire)) {
+				return false;
+			}
+			tokenize_start(&P.t, b->data, b->len);
+			P.dealing = true;
+			P.ntok = P.itok = P.cut = 0;
+		}
+		if (P.itok == P.ntok) {
+			P.itok = P.cut = 0;
+			P.ntok = tokenize(&P.t, P.tok, TOKENS);
+			if (P.ntok == 0) {
+				release();
+				continue;
+			}
+		}
+
+		struct token *t = P.tok + P.itok;
+		const char *p = b->data + t->off + P.cut;
+		size_t n = t->len - P.cut;
+
+		if (n > PIECE) {
+			/* do not cut a character in two */
+			for (n = PIECE; n > 1 && (p[n] & 0xc0) == 0x80;
+					n -= 1) {
+				;
+			}
+		}
+		memcpy(buf->data, p, n);
+		buf->data[n] = '\0';
+		*pos = b->pos + t->off + P.cut;
+		*s = (struct string){ .data = buf->data, .len = n + 1 };
+		measure_string(s, buf->wide);
+		if ((P.cut += n) == t->len) {
+			P.itok += 1;
+			P.cut = 0;
+		}
+		return true;
+	}
+	return false;
+}
+
+
+/* Return true once every word of the passage has been dealt */
+bool
+passage_done(void)
+{
+	return P.done;
+}
+
+
+/*
+ * Stop reading the passage, and save pos as where the next game of it
+ * should start, or start again at the top if pos is negative.
+ */
+void
+passage_close(off_t pos)
+{
+	if (! P.running) {
+		return;
+	}
+	/* The reader may be waiting on a pipe, or for a buffer */
+	pthread_cancel(P.reader);
+	pthread_join(P.reader, NULL);
+	sem_destroy(&P.empty);
+	close(P.fd);
+	save_pos(pos < 0 ? 0 : pos);
+	free(P.path);
+	P.running = false;
+}
+
+
+/* Return the offset of the next word to be dealt */
+off_t
+passage_tell(void)
+{
+	struct buffer *b = P.buf + P.cur;
+
+	if (P.done) {
+		return -1;
+	}
+	if (P.dealing && P.itok < P.ntok) {
+		return b->pos + P.tok[P.itok].off + P.cut;
+	}
+	if (P.dealing) {
+		/* at or before the next word */
+		return b->pos + (P.t.in_word ? P.t.start : P.t.pos);
+	}
+	return P.next;
+}
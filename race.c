@@ -0,0 +1,330 @@
+/*
+ * Race another letters over a Unix domain socket.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * The first game started with --race PATH listens on PATH, and the
+ * second connects to it.  Each sends the other a hello giving its
+ * screen size, starting level, rate of new words, the fingerprint of
+ * its word list, and a seed.  Both then play on the smaller of the two
+ * screens, from the seed of the game that listened, so both are dealt
+ * the same words.
+ *
+ * After that, all that passes is the keys each player types, with
+ * the tick of the game at which each was handled, and a note of the
+ * tick each time the game moves on without a key.  Every game is
+ * deterministic given its seed and its keys, so each side replays
+ * the other's game from these alone.  A message is a varint of the
+ * ticks since the last message, shifted left by one, with the low
+ * bit set if a varint key follows: a key costs two or three bytes.
+ *
+ * Keys are sent after they are handled, and messages are read only
+ * between ticks, so racing adds no latency to the player's own keys.
+ */
+
+#include "letters.h"
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define RACE_MAGIC 0x4c545253  /* "LTRS" */
+#define RACE_VERSION 2
+#define HELLO_SIZE 28
+
+static struct {
+	int fd;
+	bool closed;           /* the other game has gone */
+	unsigned long sent;    /* tick of the last message sent */
+	unsigned long recvd;   /* tick of the last message received */
+	unsigned char in[4096];
+	size_t len;            /* bytes in in */
+	unsigned char *out;    /* bytes not yet taken by the socket */
+	size_t olen;
+	size_t ocap;
+} R = { .fd = -1 };
+
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+	for (int i = 0; i < 4; i += 1) {
+		p[i] = v >> (24 - 8 * i);
+	}
+}
+
+
+static uint32_t
+get32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+
+static void
+write_all(const unsigned char *p, size_t n)
+{
+	while (n > 0) {
+		ssize_t k = write(R.fd, p, n);
+
+		if (k == -1 && errno != EINTR) {
+			die("race");
+		}
+		p += k > 0 ? k : 0;
+		n -= k > 0 ? k : 0;
+	}
+}
+
+
+static void
+read_all(unsigned char *p, size_t n)
+{
+	while (n > 0) {
+		ssize_t k = read(R.fd, p, n);
+
+		if (k == 0) {
+			errno = 0;
+			die("race: the other game hung up");
+		}
+		if (k == -1 && errno != EINTR) {
+			die("race");
+		}
+		p += k > 0 ? k : 0;
+		n -= k > 0 ? k : 0;
+	}
+}
+
+
+/* Connect to the game listening on path, or else listen for one */
+static bool
+meet(const char *path)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(path) >= sizeof sa.sun_path) {
+		errno = 0;
+		die("race: socket path too long: %s", path);
+	}
+	strcpy(sa.sun_path, path);
+	if ((R.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+		die("socket");
+	}
+	if (connect(R.fd, (struct sockaddr *)&sa, sizeof sa) == 0) {
+		return false;
+	}
+	if (errno == ECONNREFUSED) {
+		unlink(path);  /* left by a game that has gone */
+	} else if (errno != ENOENT) {
+		die("race: %s", path);
+	}
+	if (
+		bind(R.fd, (struct sockaddr *)&sa, sizeof sa) == -1
+		|| listen(R.fd, 1) == -1
+	) {
+		die("race: %s", path);
+	}
+	fprintf(stderr, "waiting for an opponent on %s\n", path);
+	while ((fd = accept4(R.fd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+		if (errno != EINTR) {
+			die("accept");
+		}
+	}
+	close(R.fd);
+	unlink(path);
+	R.fd = fd;
+	return true;
+}
+
+
+/*
+ * Meet another game on the socket path and agree the terms of the
+ * race.  mine gives the level this game starts at and its word list.
+ * The other game's hello is put in theirs, and both are given the
+ * screen size and seed the two games will play with.
+ */
+void
+race_start(const char *path, struct race_hello *mine,
+	struct race_hello *theirs)
+{
+	unsigned char out[HELLO_SIZE], in[HELLO_SIZE];
+	struct winsize ws;
+	bool host = meet(path);
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1) {
+		die("race: can not get the screen size");
+	}
+	mine->rows = ws.ws_row;
+	mine->cols = ws.ws_col;
+	put32(out, RACE_MAGIC);
+	put32(out + 4, RACE_VERSION);
+	put32(out + 8, mine->rows << 16 | mine->cols);
+	put32(out + 12, mine->level);
+	put32(out + 16, mine->words);
+	put32(out + 20, mine->seed);
+	put32(out + 24, mine->rate);
+	write_all(out, sizeof out);
+	read_all(in, sizeof in);
+	if (get32(in) != RACE_MAGIC || get32(in + 4) != RACE_VERSION) {
+		errno = 0;
+		die("race: the other game does not speak this protocol");
+	}
+	theirs->rows = get32(in + 8) >> 16;
+	theirs->cols = get32(in + 8) & 0xffff;
+	theirs->level = get32(in + 12);
+	theirs->words = get32(in + 16);
+	theirs->seed = get32(in + 20);
+	theirs->rate = get32(in + 24);
+	if (theirs->words != mine->words) {
+		errno = 0;
+		die("race: the other game has a different word list");
+	}
+	if (! host) {
+		mine->seed = theirs->seed;
+	}
+	theirs->seed = mine->seed;
+	if (theirs->rows < mine->rows) {
+		mine->rows = theirs->rows;
+	}
+	if (theirs->cols < mine->cols) {
+		mine->cols = theirs->cols;
+	}
+	theirs->rows = mine->rows;
+	theirs->cols = mine->cols;
+	fcntl(R.fd, F_SETFL, fcntl(R.fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+/* Write what the socket will take of the bytes waiting to go */
+static void
+flush(void)
+{
+	size_t done = 0;
+
+	while (done < R.olen && ! R.closed) {
+		ssize_t k = write(R.fd, R.out + done, R.olen - done);
+
+		if (k > 0) {
+			done += k;
+		} else if (errno == EAGAIN) {
+			break;  /* the rest goes with the next message */
+		} else if (errno != EINTR) {
+			R.closed = true;
+		}
+	}
+	memmove(R.out, R.out + done, R.olen - done);
+	R.olen -= done;
+}
+
+
+static void
+put_varint(unsigned long v)
+{
+	if (R.olen + 10 > R.ocap) {
+		R.ocap = R.ocap ? 2 * R.ocap : 256;
+		if ((R.out = realloc(R.out, R.ocap)) == NULL) {
+			die("out of memory");
+		}
+	}
+	do {
+		R.out[R.olen++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+		v >>= 7;
+	} while (v);
+}
+
+
+/*
+ * Tell the other game that this one handled key, or if key is
+ * negative, just that it has moved on, at tick.
+ */
+void
+race_send(unsigned long tick, int key)
+{
+	if (R.fd == -1 || R.closed || (key < 0 && tick == R.sent)) {
+		return;
+	}
+	put_varint((tick - R.sent) << 1 | (key >= 0));
+	if (key >= 0) {
+		put_varint(key);
+	}
+	R.sent = tick;
+	flush();
+}
+
+
+/* Decode a varint from in[*at...], or return false if it is not all there */
+static bool
+get_varint(size_t *at, unsigned long *v)
+{
+	*v = 0;
+	for (int shift = 0; *at < R.len; shift += 7) {
+		unsigned char c = R.in[(*at)++];
+
+		*v |= (unsigned long)(c & 0x7f) << shift;
+		if (! (c & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/*
+ * Take the next message from the other game: the tick at which it
+ * handled key, or moved on if key is set negative.  Return false if
+ * no whole message has arrived.
+ */
+bool
+race_recv(unsigned long *tick, int *key)
+{
+	size_t at = 0;
+	unsigned long v, k = 0;
+
+	if (R.fd == -1) {
+		return false;
+	}
+	while (! get_varint(&at, &v) || ((v & 1) && ! get_varint(&at, &k))) {
+		ssize_t n;
+
+		if (R.closed || R.len == sizeof R.in) {
+			return false;
+		}
+		if ((n = read(R.fd, R.in + R.len, sizeof R.in - R.len)) > 0) {
+			R.len += n;
+		} else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+			R.closed = true;
+		} else {
+			return false;
+		}
+		at = 0;
+	}
+	memmove(R.in, R.in + at, R.len - at);
+	R.len -= at;
+	R.recvd += v >> 1;
+	*tick = R.recvd;
+	*key = v & 1 ? (int)k : -1;
+	return true;
+}
+
+
+/* Return true once the other game has gone and all it sent is read */
+bool
+race_over(void)
+{
+	return R.closed && R.len == 0;
+}
+
+
+void
+race_end(void)
+{
+	if (R.fd != -1) {
+		fcntl(R.fd, F_SETFL, fcntl(R.fd, F_GETFL) & ~O_NONBLOCK);
+		flush();
+		close(R.fd);
+		free(R.out);
+		R.fd = -1;
+	}
+}
@@ -0,0 +1,170 @@
+/*
+ * Reload the word list of a running game when its file changes.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * A watcher thread waits, with inotify, for the -d word list to be
+ * written or replaced.  It then loads the new list itself, front
+ * coding it and building its alias table as at startup, and offers
+ * it to the game with offer_dictionary().  The game swaps it in at
+ * its next getword(), which is a pointer exchange, so the game never
+ * waits for a load.  The dictionaries swapped out are freed by this
+ * thread too.
+ *
+ * The directory is watched rather than the file, so that a list
+ * replaced by renaming a new file over it, as editors do, is seen.
+ * Without inotify, lists are never reloaded.
+ */
+
+#include "letters.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+
+/* Time allowed for a burst of writes to the list to finish */
+#define SETTLE_MS 200
+
+/* How often swapped out dictionaries are freed when nothing changes */
+#define COLLECT_MS 1000
+
+static struct {
+	const char *path;
+	const char *name;  /* last component of path */
+	char *dir;
+	int fd;            /* inotify */
+	int stop[2];
+	bool running;
+	pthread_t watcher;
+} W;
+
+
+/* Read pending events.  Return true if any were for the word list. */
+static bool
+changed(void)
+{
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	bool hit = false;
+	ssize_t n;
+
+	while ((n = read(W.fd, buf, sizeof buf)) > 0) {
+		for (char *p = buf; p < buf + n; ) {
+			struct inotify_event *e = (struct inotify_event *)p;
+			if (e->len && strcmp(e->name, W.name) == 0) {
+				hit = true;
+			}
+			p += sizeof *e + e->len;
+		}
+	}
+	return hit;
+}
+
+
+static void *
+watcher(void *arg)
+{
+	struct pollfd fds[2] = {
+		{ .fd = W.fd, .events = POLLIN },
+		{ .fd = W.stop[0], .events = POLLIN },
+	};
+
+	for (;;) {
+		int n = poll(fds, 2, COLLECT_MS);
+
+		if (n == -1 && errno != EINTR) {
+			break;
+		}
+		if (fds[1].revents) {
+			break;
+		}
+		if (n > 0 && changed()) {
+			/* Let the writer finish, then take the list as it is */
+			while (poll(fds, 1, SETTLE_MS) > 0) {
+				changed();
+			}
+			struct dictionary *d = load_dictionary(W.path,
+				allocator(A_DICTIONARY));
+			if (d) {
+				offer_dictionary(d);
+			}
+		} else {
+			collect_dictionaries();
+		}
+	}
+	return arg;
+}
+
+
+/* Reload the word list from path whenever it changes */
+void
+dictionary_watch(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	sigset_t all, old;
+
+	W.path = path;
+	W.name = slash ? slash + 1 : path;
+	W.dir = slash ? strndup(path, slash == path ? 1 : slash - path)
+		: strdup(".");
+	if (W.dir == NULL) {
+		return;
+	}
+	if ((W.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		free(W.dir);
+		return;
+	}
+	if (
+		inotify_add_watch(W.fd, W.dir,
+			IN_CLOSE_WRITE | IN_MOVED_TO) == -1
+		|| pipe(W.stop) == -1
+	) {
+		close(W.fd);
+		free(W.dir);
+		return;
+	}
+
+	/* Leave the signals to the game loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	W.running = pthread_create(&W.watcher, NULL, watcher, NULL) == 0;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+
+/* Stop watching the word list */
+void
+dictionary_unwatch(void)
+{
+	if (W.running) {
+		if (write(W.stop[1], "", 1) == -1) {
+			;
+		}
+		pthread_join(W.watcher, NULL);
+		close(W.stop[0]);
+		close(W.stop[1]);
+		close(W.fd);
+		free(W.dir);
+		W.running = false;
+	}
+}
+
+#else
+
+void
+dictionary_watch(const char *path)
+{
+	(void)path;
+}
+
+
+void
+dictionary_unwatch(void)
+{
+}
+
+#endif
@@ -0,0 +1,730 @@
+/*
+ * Report on many players' games of letters.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * letters-report reads the session logs written by letters -t, and
+ * high score files, and prints for each player and for each cohort the
+ * games played, the best score, the highest level reached, percentiles
+ * of the words per minute of their games and how that has changed over
+ * time.  Each directory named is a cohort, and every file under it is
+ * read; a file named by itself belongs to the cohort of its directory.
+ *
+ * A pool of threads takes files from the list in turn.  Each thread
+ * reads its files a megabyte at a time and keeps a table of its own of
+ * the players it has seen, which is merged with the others' once all
+ * files are read, so the threads share nothing but the index of the
+ * next file.  A player's games are summed up as they are read, so the
+ * memory needed grows with the number of players, not of records: the
+ * words per minute go into a histogram with a bin for each, and their
+ * trend over time is kept as means and co-moments, which merge exactly.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WPM_MAX 256            /* bins of the histogram; the last, the rest */
+#define NAME_MAX_LEN 64
+#define BUF_SIZE (1 << 20)
+#define SECONDS_PER_WEEK (7 * 24 * 3600.0)
+
+struct stats {
+	unsigned long games;
+	int best;              /* score, or -1 if none is known */
+	int level;
+	time_t first;          /* start of the first and last game, or 0 */
+	time_t last;
+	unsigned long wpm[WPM_MAX];
+	/* of games' words per minute against their start times */
+	double n, mean_t, mean_w, c_tw, c_tt;
+};
+
+struct player {
+	char name[NAME_MAX_LEN];
+	unsigned cohort;
+	struct stats s;
+	struct player *next;
+};
+
+struct table {
+	struct player **bucket;
+	size_t size;           /* a power of 2 */
+	size_t count;
+	unsigned long records;
+	unsigned long files;
+};
+
+/* A game being read from a session log */
+struct game {
+	bool open;
+	char name[NAME_MAX_LEN];
+	time_t start;
+	int level;
+	int score;
+	int wpm;
+};
+
+struct file {
+	char *path;
+	unsigned cohort;
+};
+
+static struct {
+	unsigned threads;
+	bool cohorts_only;
+} opt;
+
+static struct {
+	struct file *v;
+	size_t n, cap;
+	atomic_size_t next;    /* to be read */
+	char **cohort;
+	unsigned ncohort;
+	unsigned current;      /* cohort of the directory being walked */
+	atomic_bool failed;
+} F;
+
+static void die(const char *fmt, ...)
+	__attribute__ ((format (printf, 1, 2), noreturn));
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fputs("letters-report: ", stderr);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (fmt[0] && fmt[strlen(fmt) - 1] == ':') {
+		fprintf(stderr, " %s", strerror(errno));
+	}
+	fputc('\n', stderr);
+	exit(EXIT_FAILURE);
+}
+
+
+static void *
+xcalloc(size_t n, size_t size)
+{
+	void *p = calloc(n, size);
+
+	if (p == NULL) {
+		die("out of memory");
+	}
+	return p;
+}
+
+
+static void
+stats_init(struct stats *s)
+{
+	memset(s, 0, sizeof *s);
+	s->best = -1;
+}
+
+
+/* Add b to a.  The co-moments are merged as by Chan, Golub and LeVeque */
+static void
+stats_merge(struct stats *a, const struct stats *b)
+{
+	double n = a->n + b->n;
+
+	a->games += b->games;
+	if (b->best > a->best) {
+		a->best = b->best;
+	}
+	if (b->level > a->level) {
+		a->level = b->level;
+	}
+	if (b->first && (a->first == 0 || b->first < a->first)) {
+		a->first = b->first;
+	}
+	if (b->last > a->last) {
+		a->last = b->last;
+	}
+	for (int i = 0; i < WPM_MAX; i += 1) {
+		a->wpm[i] += b->wpm[i];
+	}
+	if (b->n > 0) {
+		double dt = b->mean_t - a->mean_t;
+		double dw = b->mean_w - a->mean_w;
+		double f = a->n * b->n / n;
+
+		a->mean_t += dt * b->n / n;
+		a->mean_w += dw * b->n / n;
+		a->c_tw += b->c_tw + dt * dw * f;
+		a->c_tt += b->c_tt + dt * dt * f;
+		a->n = n;
+	}
+}
+
+
+/* Return the smallest words per minute of at least pct% of the games */
+static int
+percentile(const struct stats *s, int pct)
+{
+	unsigned long total = 0, sum = 0;
+
+	for (int i = 0; i < WPM_MAX; i += 1) {
+		total += s->wpm[i];
+	}
+	for (int i = 0; i < WPM_MAX; i += 1) {
+		if ((sum += s->wpm[i]) * 100 >= total * pct && sum > 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+static uint32_t
+hash(const char *name, unsigned cohort)
+{
+	uint32_t h = 2166136261u ^ cohort;
+
+	for (; *name; name += 1) {
+		h = (h ^ (unsigned char)*name) * 16777619u;
+	}
+	return h;
+}
+
+
+static struct player *
+lookup(struct table *t, const char *name, unsigned cohort)
+{
+	struct player **b, *p;
+
+	if (t->count >= t->size) {
+		size_t size = t->size ? 2 * t->size : 64;
+		struct player **v = xcalloc(size, sizeof *v);
+
+		for (size_t i = 0; i < t->size; i += 1) {
+			while ((p = t->bucket[i]) != NULL) {
+				t->bucket[i] = p->next;
+				b = v + (hash(p->name, p->cohort) & (size - 1));
+				p->next = *b;
+				*b = p;
+			}
+		}
+		free(t->bucket);
+		t->bucket = v;
+		t->size = size;
+	}
+	b = t->bucket + (hash(name, cohort) & (t->size - 1));
+	for (p = *b; p; p = p->next) {
+		if (p->cohort == cohort && strcmp(p->name, name) == 0) {
+			return p;
+		}
+	}
+	p = xcalloc(1, sizeof *p);
+	snprintf(p->name, sizeof p->name, "%s", name);
+	p->cohort = cohort;
+	stats_init(&p->s);
+	p->next = *b;
+	*b = p;
+	t->count += 1;
+	return p;
+}
+
+
+static const char *
+basename_of(const char *path)
+{
+	const char *s = strrchr(path, '/');
+
+	return s ? s + 1 : path;
+}
+
+
+/* Count a game that has been read to its end, or to the end of its log */
+static void
+finish(struct table *t, struct game *g, const struct file *f)
+{
+	struct stats *s;
+	int w = g->wpm;
+
+	if (! g->open) {
+		return;
+	}
+	g->open = false;
+	s = &lookup(t, g->name[0] ? g->name : basename_of(f->path),
+		f->cohort)->s;
+	s->games += 1;
+	if (g->score > s->best) {
+		s->best = g->score;
+	}
+	if (g->level > s->level) {
+		s->level = g->level;
+	}
+	if (g->start) {
+		if (s->first == 0 || g->start < s->first) {
+			s->first = g->start;
+		}
+		if (g->start > s->last) {
+			s->last = g->start;
+		}
+	}
+	if (w >= 0) {
+		s->wpm[w < WPM_MAX ? w : WPM_MAX - 1] += 1;
+		if (g->start) {
+			struct stats one = {
+				.best = -1, .n = 1,
+				.mean_t = g->start, .mean_w = w,
+			};
+
+			stats_merge(s, &one);
+		}
+	}
+}
+
+
+/* Find "key": in the line, and return what follows it, or NULL */
+static const char *
+field(const char *line, const char *end, const char *key)
+{
+	char pat[32];
+	int n = snprintf(pat, sizeof pat, "\"%s\":", key);
+	const char *p = memmem(line, end - line, pat, n);
+
+	return p ? p + n : NULL;
+}
+
+
+static long long
+number(const char *line, const char *end, const char *key, long long none)
+{
+	const char *p = field(line, end, key);
+
+	return p ? strtoll(p, NULL, 10) : none;
+}
+
+
+/* Copy the JSON string at p, which ends before end, to buf */
+static void
+string(const char *p, const char *end, char *buf, size_t size)
+{
+	size_t n = 0;
+
+	if (p == NULL || p == end || *p++ != '"') {
+		buf[0] = '\0';
+		return;
+	}
+	for (; p < end && *p != '"'; p += 1) {
+		if (*p == '\\' && p + 1 < end) {
+			p += 1;
+			/* letters escapes only control characters */
+			if (*p == 'u') {
+				p += p + 4 < end ? 4 : 0;
+				continue;
+			}
+		}
+		if (n + 1 < size) {
+			buf[n++] = *p;
+		}
+	}
+	buf[n] = '\0';
+}
+
+
+/* Take in a line of a session log */
+static void
+log_line(struct table *t, struct game *g, const struct file *f,
+	const char *line, const char *end)
+{
+	const char *ev = field(line, end, "ev");
+	int level;
+
+	if (ev == NULL || strncmp(ev, "\"dropped\"", 9) == 0) {
+		return;
+	}
+	t->records += 1;
+	if (strncmp(ev, "\"start\"", 7) == 0) {
+		finish(t, g, f);
+		*g = (struct game){ .open = true, .score = -1, .wpm = -1 };
+		g->start = number(line, end, "time", 0);
+		string(field(line, end, "user"), end, g->name, sizeof g->name);
+	} else if (! g->open) {
+		/* The start of the game was lost: count it as the file's */
+		*g = (struct game){ .open = true, .score = -1, .wpm = -1 };
+	}
+	if ((level = number(line, end, "level", 0)) > g->level) {
+		g->level = level;
+	}
+	if (strncmp(ev, "\"wpm\"", 5) == 0) {
+		g->wpm = number(line, end, "game_wpm", -1);
+	} else if (strncmp(ev, "\"end\"", 5) == 0) {
+		g->score = number(line, end, "score", -1);
+		finish(t, g, f);
+	}
+}
+
+
+/* Take in a line of a high score file: a game with no time or speed */
+static void
+score_line(struct table *t, const struct file *f, const char *line,
+	const char *end)
+{
+	char buf[128], name[NAME_MAX_LEN];
+	int level, words, score;
+	struct stats *s;
+
+	if ((size_t)(end - line) >= sizeof buf) {
+		return;
+	}
+	memcpy(buf, line, end - line);
+	buf[end - line] = '\0';
+	if (sscanf(buf, "%63s %d %d %d", name, &level, &words, &score) != 4) {
+		return;
+	}
+	t->records += 1;
+	s = &lookup(t, name, f->cohort)->s;
+	s->games += 1;
+	if (score > s->best) {
+		s->best = score;
+	}
+	if (level > s->level) {
+		s->level = level;
+	}
+}
+
+
+static void
+read_file(struct table *t, const struct file *f, char *buf)
+{
+	struct game g = { .open = false };
+	int fd = open(f->path, O_RDONLY);
+	enum { UNKNOWN, LOG, SCORES } kind = UNKNOWN;
+	size_t len = 0;
+	ssize_t n;
+
+	if (fd == -1) {
+		fprintf(stderr, "letters-report: %s: %s\n", f->path,
+			strerror(errno));
+		atomic_store(&F.failed, true);
+		return;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	t->files += 1;
+	do {
+		char *line = buf, *nl;
+
+		while ((n = read(fd, buf + len, BUF_SIZE - len)) == -1
+				&& errno == EINTR) {
+			;
+		}
+		if (n == -1) {
+			fprintf(stderr, "letters-report: %s: %s\n", f->path,
+				strerror(errno));
+			atomic_store(&F.failed, true);
+			break;
+		}
+		len += n;
+		if (kind == UNKNOWN) {
+			size_t i = 0;
+
+			while (i < len && isspace((unsigned char)buf[i])) {
+				i += 1;
+			}
+			if (i < len) {
+				kind = buf[i] == '{' ? LOG : SCORES;
+			}
+		}
+		/* At the end, or if a line fills the buffer, take it all */
+		while (
+			(nl = memchr(line, '\n', buf + len - line)) != NULL
+			|| ((n == 0 || (len == BUF_SIZE && line == buf))
+				&& line < buf + len && (nl = buf + len))
+		) {
+			if (kind == LOG) {
+				log_line(t, &g, f, line, nl);
+			} else {
+				score_line(t, f, line, nl);
+			}
+			line = nl + 1 < buf + len ? nl + 1 : buf + len;
+		}
+		len -= line - buf;
+		memmove(buf, line, len);
+	} while (n > 0);
+	finish(t, &g, f);
+	close(fd);
+}
+
+
+static void *
+worker(void *arg)
+{
+	struct table *t = arg;
+	char *buf = malloc(BUF_SIZE);
+	size_t i;
+
+	if (buf == NULL) {
+		die("out of memory");
+	}
+	while ((i = atomic_fetch_add(&F.next, 1)) < F.n) {
+		read_file(t, F.v + i, buf);
+	}
+	free(buf);
+	return NULL;
+}
+
+
+static unsigned
+cohort(const char *name)
+{
+	for (unsigned i = 0; i < F.ncohort; i += 1) {
+		if (strcmp(F.cohort[i], name) == 0) {
+			return i;
+		}
+	}
+	F.cohort = realloc(F.cohort, (F.ncohort + 1) * sizeof *F.cohort);
+	if (F.cohort == NULL || (F.cohort[F.ncohort] = strdup(name)) == NULL) {
+		die("out of memory");
+	}
+	return F.ncohort++;
+}
+
+
+static void
+add_file(const char *path, unsigned c)
+{
+	if (F.n == F.cap) {
+		F.cap = F.cap ? 2 * F.cap : 256;
+		if ((F.v = realloc(F.v, F.cap * sizeof *F.v)) == NULL) {
+			die("out of memory");
+		}
+	}
+	if ((F.v[F.n].path = strdup(path)) == NULL) {
+		die("out of memory");
+	}
+	F.v[F.n++].cohort = c;
+}
+
+
+static int
+walk(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+	(void)ftw;
+	if (type == FTW_F && S_ISREG(sb->st_mode)) {
+		add_file(path, F.current);
+	} else if (type == FTW_DNR || type == FTW_NS) {
+		fprintf(stderr, "letters-report: %s: can not read\n", path);
+		atomic_store(&F.failed, true);
+	}
+	return 0;
+}
+
+
+/* Add the files of the cohort directory, or the file, at path */
+static void
+add_path(const char *path)
+{
+	struct stat sb;
+
+	if (stat(path, &sb) == -1) {
+		die("%s:", path);
+	}
+	if (S_ISDIR(sb.st_mode)) {
+		F.current = cohort(path);
+		if (nftw(path, walk, 16, FTW_PHYS) == -1) {
+			die("%s:", path);
+		}
+	} else {
+		const char *s = strrchr(path, '/');
+		char dir[PATH_MAX];
+
+		snprintf(dir, sizeof dir, "%.*s", s ? (int)(s - path) : 1,
+			s ? path : ".");
+		add_file(path, cohort(dir[0] ? dir : "/"));
+	}
+}
+
+
+/* Move the players of b into a */
+static void
+table_merge(struct table *a, struct table *b)
+{
+	for (size_t i = 0; i < b->size; i += 1) {
+		struct player *p, *next;
+
+		for (p = b->bucket[i]; p; p = next) {
+			next = p->next;
+			stats_merge(&lookup(a, p->name, p->cohort)->s, &p->s);
+			free(p);
+		}
+	}
+	free(b->bucket);
+	a->records += b->records;
+	a->files += b->files;
+}
+
+
+static int
+by_cohort_and_name(const void *a, const void *b)
+{
+	const struct player *p = *(struct player * const *)a;
+	const struct player *q = *(struct player * const *)b;
+
+	return p->cohort != q->cohort ? (p->cohort > q->cohort) * 2 - 1
+		: strcmp(p->name, q->name);
+}
+
+
+static void
+date(char *buf, size_t size, time_t t)
+{
+	struct tm tm;
+
+	if (t == 0 || localtime_r(&t, &tm) == NULL) {
+		snprintf(buf, size, "-");
+	} else {
+		strftime(buf, size, "%Y-%m-%d", &tm);
+	}
+}
+
+
+static void
+report_line(const char *name, const struct stats *s)
+{
+	char first[16], last[16], trend[16] = "-";
+	int p[3] = { percentile(s, 10), percentile(s, 50), percentile(s, 90) };
+	char pct[3][8];
+
+	for (int i = 0; i < 3; i += 1) {
+		snprintf(pct[i], sizeof pct[i], p[i] < 0 ? "-" : "%d", p[i]);
+	}
+	if (s->n >= 2 && s->c_tt > 0) {
+		snprintf(trend, sizeof trend, "%+.1f",
+			s->c_tw / s->c_tt * SECONDS_PER_WEEK);
+	}
+	date(first, sizeof first, s->first);
+	date(last, sizeof last, s->last);
+	printf("  %-20s %7lu %7d %5d %5s %5s %5s %7s %10s %10s\n", name,
+		s->games, s->best < 0 ? 0 : s->best, s->level, pct[0], pct[1],
+		pct[2], trend, first, last);
+}
+
+
+static void
+report(struct table *t)
+{
+	struct player **v = xcalloc(t->count + 1, sizeof *v);
+	size_t n = 0;
+
+	for (size_t i = 0; i < t->size; i += 1) {
+		for (struct player *p = t->bucket[i]; p; p = p->next) {
+			v[n++] = p;
+		}
+	}
+	qsort(v, n, sizeof *v, by_cohort_and_name);
+	printf("  %-20s %7s %7s %5s %5s %5s %5s %7s %10s %10s\n", "player",
+		"games", "best", "level", "p10", "p50", "p90", "wpm/wk",
+		"first", "last");
+	for (size_t i = 0; i < n;) {
+		unsigned c = v[i]->cohort;
+		struct stats all;
+		char name[32];
+		size_t players = 0;
+
+		stats_init(&all);
+		printf("%s\n", F.cohort[c]);
+		for (; i < n && v[i]->cohort == c; i += 1, players += 1) {
+			if (! opt.cohorts_only) {
+				report_line(v[i]->name, &v[i]->s);
+			}
+			stats_merge(&all, &v[i]->s);
+		}
+		snprintf(name, sizeof name, "all %zu", players);
+		report_line(name, &all);
+	}
+	free(v);
+}
+
+
+static void
+usage(const char *progname)
+{
+	printf("usage: %s [-c] [-j threads] path...\n\n", progname);
+	puts("option:");
+	puts("  -c     report only on cohorts, not on each player");
+	puts("  -h     print usage statement");
+	puts("  -j     number of files to read at once (default: one per cpu)");
+}
+
+
+int
+main(int argc, char **argv)
+{
+	struct timespec t0, t1;
+	struct table *t;
+	pthread_t *tid;
+	int c;
+
+	opt.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt(argc, argv, "chj:")) != -1) {
+		switch (c) {
+		case 'c': opt.cohorts_only = true; break;
+		case 'j': opt.threads = strtoul(optarg, NULL, 10); break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind == argc) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (opt.threads == 0) {
+		die("threads must be positive");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (; optind < argc; optind += 1) {
+		add_path(argv[optind]);
+	}
+	if (opt.threads > F.n) {
+		opt.threads = F.n ? F.n : 1;
+	}
+	t = xcalloc(opt.threads, sizeof *t);
+	tid = xcalloc(opt.threads, sizeof *tid);
+	for (unsigned i = 1; i < opt.threads; i += 1) {
+		errno = pthread_create(tid + i, NULL, worker, t + i);
+		if (errno != 0) {
+			die("pthread_create:");
+		}
+	}
+	worker(t);
+	for (unsigned i = 1; i < opt.threads; i += 1) {
+		pthread_join(tid[i], NULL);
+		table_merge(t, t + i);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	report(t);
+	printf("%lu files, %lu records, %zu players read in %.3f seconds by "
+		"%u threads\n", t->files, t->records, t->count,
+		(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9,
+		opt.threads);
+	return atomic_load(&F.failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,587 @@
+/*
+ * Screen output for letters: curses, or direct ANSI escape sequences.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * All drawing during the game goes through the screen_ functions here.
+ * With the curses backend they are thin wrappers around curses.  The
+ * ANSI backend draws into a cell buffer instead and, on screen_refresh(),
+ * compares it with the cells already on the terminal and emits cursor
+ * moves, attribute changes and characters for the cells that changed
+ * into one preallocated buffer, flushed with a single write().
+ * Curses is still used to set up the terminal, to read keys and for
+ * the high score screen.  The ANSI backend is only used if the
+ * terminal's cursor addressing is the ANSI one; otherwise curses is
+ * used regardless.
+ *
+ * When asked to, bytes and write()s per frame are counted for both
+ * backends.  Curses does its own writing, so its figures are taken
+ * from the process's I/O counters in /proc/self/io before and after
+ * each refresh().  The curses backend also keeps the ANSI cell buffer
+ * up to date and computes (but does not write) what the ANSI backend
+ * would have sent, so a single session can compare the two.
+ */
+
+#include "letters.h"
+
+/*
+ * Worst case bytes for a cell: a cursor move, an attribute, a character
+ * and a combining mark
+ */
+#define CELL_BYTES (sizeof "\033[999;999H" + sizeof "\033[7m" + 2 * MB_LEN_MAX)
+
+struct cell {
+	wchar_t ch;    /* 0 for the right half of a double width character */
+	int attr;      /* 0, or 1 for standout; -1 if unknown */
+	wchar_t mark;  /* a zero width character drawn over ch, or 0 */
+};
+
+struct output {
+	unsigned long frames;
+	unsigned long bytes;
+	unsigned long writes;
+};
+
+static struct {
+	enum backend backend;
+	bool shadow;          /* maintain the cells for the curses backend */
+	int io;               /* /proc/self/io, or -1 */
+	int rows, width;      /* size of the cell buffers */
+	struct cell *back;    /* the frame being drawn */
+	struct cell *front;   /* what is on the terminal */
+	char *buf;            /* output for one frame */
+	size_t len;
+	int y, x;             /* cursor of the frame being drawn */
+	int attr;             /* attribute of the frame being drawn */
+	bool full;            /* front is not to be trusted */
+	WINDOW *popup;        /* to be shown over the frame being drawn */
+	struct output out[2]; /* indexed by backend */
+} T = { .backend = B_CURSES, .io = -1 };
+
+
+static void
+count_write(enum backend b, const char *s, size_t n)
+{
+	T.out[b].bytes += n;
+	while (n > 0) {
+		ssize_t k = write(STDOUT_FILENO, s, n);
+		T.out[b].writes += 1;
+		if (k < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		s += k;
+		n -= k;
+	}
+}
+
+
+/* Read the bytes and write()s made so far by the process */
+static bool
+proc_io(unsigned long *bytes, unsigned long *writes)
+{
+	char buf[512];
+	ssize_t n;
+	char *p;
+
+	if (T.io < 0 || (n = pread(T.io, buf, sizeof buf - 1, 0)) <= 0) {
+		return false;
+	}
+	buf[n] = '\0';
+	if (
+		(p = strstr(buf, "wchar:")) == NULL ||
+		sscanf(p, "wchar: %lu", bytes) != 1 ||
+		(p = strstr(buf, "syscw:")) == NULL ||
+		sscanf(p, "syscw: %lu", writes) != 1
+	) {
+		return false;
+	}
+	return true;
+}
+
+
+/* (Re)size the cell buffers to the screen, if it has changed size */
+static void
+fit_screen(void)
+{
+	reallocator r = allocator(A_SCREEN);
+	size_t n;
+
+	if (T.rows == LINES && T.width == COLS) {
+		return;
+	}
+	T.rows = LINES;
+	T.width = COLS;
+	n = (size_t)LINES * COLS;
+	T.back = r(T.back, n * sizeof *T.back);
+	T.front = r(T.front, n * sizeof *T.front);
+	T.buf = r(T.buf, n * CELL_BYTES + sizeof "\033[H\033[2J\033[m");
+	if (T.back == NULL || T.front == NULL || T.buf == NULL) {
+		die("out of memory");
+	}
+	T.full = true;
+}
+
+
+static bool
+cells(void)
+{
+	return T.backend == B_ANSI || T.shadow;
+}
+
+
+/*
+ * Initialize curses and the chosen backend.  If stats is set, keep
+ * the figures needed by screen_stats() for both backends.
+ */
+void
+screen_init(enum backend b, bool stats)
+{
+	const char *cup;
+
+	initscr();
+
+	cup = tigetstr("cup");
+	if (b == B_ANSI && (cup == NULL || cup == (char *)-1
+			|| strncmp(cup, "\033[", 2) != 0)) {
+		b = B_CURSES;
+	}
+	T.backend = b;
+	T.shadow = stats && b == B_CURSES;
+	if (T.shadow) {
+		T.io = open("/proc/self/io", O_RDONLY);
+	}
+	if (cells()) {
+		fit_screen();
+	}
+}
+
+
+enum backend
+screen_backend(void)
+{
+	return T.backend;
+}
+
+
+/* Redraw everything on the next screen_refresh() */
+void
+screen_invalidate(void)
+{
+	T.full = true;
+	if (T.backend == B_CURSES) {
+		clearok(curscr, TRUE);
+	}
+}
+
+
+void
+screen_erase(void)
+{
+	if (T.backend == B_CURSES) {
+		erase();
+	}
+	if (cells()) {
+		fit_screen();
+		for (int i = 0; i < T.rows * T.width; i += 1) {
+			T.back[i] = (struct cell){ L' ', 0, 0 };
+		}
+		T.y = T.x = T.attr = 0;
+	}
+}
+
+
+void
+screen_move(int y, int x)
+{
+	if (T.backend == B_CURSES) {
+		move(y, x);
+	}
+	T.y = y;
+	T.x = x;
+}
+
+
+void
+screen_standout(bool on)
+{
+	if (T.backend == B_CURSES) {
+		if (on) {
+			attron(A_STANDOUT);
+		} else {
+			attroff(A_STANDOUT);
+		}
+	}
+	T.attr = on;
+}
+
+
+/*
+ * Put one character of the given width at the cursor.  One of width 0,
+ * such as a combining accent, goes in the cell of the character before
+ * it, as it does on the terminal; any more than one there are dropped.
+ */
+static void
+put_cell(wchar_t c, int width)
+{
+	struct cell *row = T.back + T.y * T.width;
+
+	if (width == 0) {
+		int x = T.x - 1;
+
+		if (T.y < 0 || T.y >= T.rows || x < 0 || x >= T.width) {
+			return;
+		}
+		if (x > 0 && row[x].ch == 0) {
+			x -= 1;  /* the right half of a wide character */
+		}
+		if (row[x].mark == 0) {
+			row[x].mark = c;
+		}
+		return;
+	}
+	if (T.y < 0 || T.y >= T.rows || T.x < 0 || T.x + width > T.width) {
+		T.x += width;
+		return;
+	}
+	row[T.x] = (struct cell){ c, T.attr, 0 };
+	if (width == 2) {
+		row[T.x + 1] = (struct cell){ 0, T.attr, 0 };
+	}
+	T.x += width;
+}
+
+
+/* Write at most n bytes (all of s if n < 0) of the ASCII string s */
+void
+screen_addnstr(const char *s, int n)
+{
+	if (T.backend == B_CURSES) {
+		addnstr(s, n);
+	}
+	if (cells()) {
+		for (; *s && n != 0; s += 1, n -= 1) {
+			put_cell((unsigned char)*s, 1);
+		}
+	}
+}
+
+
+/* Write at most n characters (all of s if n < 0) of s */
+void
+screen_addnwstr(const wchar_t *s, int n)
+{
+	if (T.backend == B_CURSES) {
+		addnwstr(s, n);
+	}
+	if (cells()) {
+		for (; *s && n != 0; s += 1, n -= 1) {
+			int w = wcwidth(*s);
+			put_cell(*s, w < 0 ? 1 : w);
+		}
+	}
+}
+
+
+void
+screen_printf(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	screen_addnstr(buf, -1);
+}
+
+
+void
+screen_clrtoeol(void)
+{
+	if (T.backend == B_CURSES) {
+		clrtoeol();
+	}
+	if (cells() && T.y >= 0 && T.y < T.rows) {
+		for (int x = T.x; x < T.width; x += 1) {
+			T.back[T.y * T.width + x] = (struct cell){ L' ', 0, 0 };
+		}
+	}
+}
+
+
+/* The size of a window's cells, which is most of what curses allocates */
+static long long
+window_bytes(WINDOW *w)
+{
+	return w ? (long long)getmaxy(w) * getmaxx(w) * sizeof(cchar_t) : 0;
+}
+
+
+/*
+ * Make a boxed message, to be drawn over frames by screen_overlay().
+ * Return a handle to pass to it, and to screen_popdown() when the
+ * message is no longer wanted.
+ */
+void *
+screen_popup(const char *text)
+{
+	WINDOW *w = NULL;
+
+	if (T.backend == B_CURSES) {
+		w = newwin(3, strlen(text) + 6, 0, 0);
+		box(w, 0, 0);
+		mvwaddstr(w, 1, 3, text);
+		alloc_charge(A_WINDOWS, window_bytes(w));
+	}
+	return w;
+}
+
+
+/*
+ * Draw the message of p, made by screen_popup(), at y, x over the frame
+ * being drawn, to be shown with it by the next screen_refresh().
+ */
+void
+screen_overlay(void *p, int y, int x, const char *text)
+{
+	int width = strlen(text) + 6;
+
+	if (T.backend == B_CURSES && p) {
+		mvwin(p, y, x);
+		T.popup = p;
+	}
+	if (! cells()) {
+		return;
+	}
+	for (int i = 0; i < 3; i += 1) {
+		screen_move(y + i, x);
+		for (int j = 0; j < width; j += 1) {
+			bool edge_y = i != 1, edge_x = j == 0 || j == width - 1;
+			put_cell(edge_y && edge_x ? L'+' : edge_y ? L'-' :
+				edge_x ? L'|' : L' ', 1);
+		}
+	}
+	screen_move(y + 1, x + 3);
+	screen_addnstr(text, -1);
+}
+
+
+void
+screen_popdown(void *p)
+{
+	if (p) {
+		T.popup = T.popup == p ? NULL : T.popup;
+		alloc_charge(A_WINDOWS, -window_bytes(p));
+		delwin(p);
+	}
+}
+
+
+static void
+emit(const char *s, size_t n)
+{
+	memcpy(T.buf + T.len, s, n);
+	T.len += n;
+}
+
+
+static void
+emit_char(wchar_t c)
+{
+	mbstate_t st;
+	size_t k;
+
+	if (c < 0x80) {
+		T.buf[T.len++] = c;
+		return;
+	}
+	memset(&st, 0, sizeof st);
+	k = wcrtomb(T.buf + T.len, c, &st);
+	if (k == (size_t)-1) {
+		T.buf[T.len++] = '?';
+	} else {
+		T.len += k;
+	}
+}
+
+
+/*
+ * Move the cursor from column cx (or from an unknown position if cx is
+ * negative) to x on row y, whose cells are row, as cheaply as possible:
+ * a short hop right rewrites the cells in between, a longer one uses
+ * a relative move and anything else an absolute one.
+ */
+static void
+move_cursor(const struct cell *row, int cx, int x, int y, int cattr)
+{
+	if (cx >= 0 && x > cx && x - cx <= 4) {
+		int i;
+		for (i = cx; i < x; i += 1) {
+			if (
+				row[i].attr != cattr || row[i].ch == 0
+				|| row[i].ch >= 0x80 || row[i].mark
+				|| (i + 1 < T.width && row[i + 1].ch == 0)
+			) {
+				break;
+			}
+		}
+		if (i == x) {
+			for (i = cx; i < x; i += 1) {
+				T.buf[T.len++] = row[i].ch;
+			}
+			return;
+		}
+	}
+	if (cx >= 0 && x > cx) {
+		T.len += sprintf(T.buf + T.len, "\033[%dC", x - cx);
+	} else {
+		T.len += sprintf(T.buf + T.len, "\033[%d;%dH", y + 1, x + 1);
+	}
+}
+
+
+/* Build the escape sequences that turn front into back */
+static void
+diff_frame(void)
+{
+	int cy = -1, cx = -1;  /* where the terminal's cursor is, if known */
+	int cattr = -1;
+
+	T.len = 0;
+	if (T.full) {
+		emit("\033[H\033[2J", sizeof "\033[H\033[2J" - 1);
+		for (int i = 0; i < T.rows * T.width; i += 1) {
+			T.front[i] = (struct cell){ L' ', -1, 0 };
+		}
+		cy = cx = 0;
+		T.full = false;
+	}
+	for (int y = 0; y < T.rows; y += 1) {
+		struct cell *b = T.back + y * T.width;
+		struct cell *f = T.front + y * T.width;
+
+		for (int x = 0; x < T.width; x += 1) {
+			int w = 1;
+
+			if (
+				b[x].ch == f[x].ch && b[x].attr == f[x].attr
+				&& b[x].mark == f[x].mark
+			) {
+				continue;
+			}
+			if (b[x].ch == 0) {
+				/* Right half changed: redraw it all */
+				if (x == 0 || b[x - 1].ch == 0) {
+					continue;
+				}
+				x -= 1;
+			}
+			if (x + 1 < T.width && b[x + 1].ch == 0) {
+				w = 2;
+			}
+			if (cy != y || cx != x) {
+				move_cursor(b, cy == y ? cx : -1, x, y, cattr);
+			}
+			if (b[x].attr != cattr) {
+				emit(b[x].attr ? "\033[7m" : "\033[m",
+					b[x].attr ? 4 : 3);
+				cattr = b[x].attr;
+			}
+			emit_char(b[x].ch);
+			if (b[x].mark) {
+				emit_char(b[x].mark);
+			}
+			for (int i = 0; i < w; i += 1) {
+				f[x + i] = b[x + i];
+			}
+			cy = y;
+			cx = x + w;
+			x += w - 1;
+		}
+	}
+	if (cattr > 0) {
+		emit("\033[m", 3);
+	}
+}
+
+
+void
+screen_refresh(void)
+{
+	if (T.backend == B_CURSES) {
+		unsigned long b0, w0, b1, w1;
+		bool counted = proc_io(&b0, &w0);
+
+		if (T.popup) {
+			wnoutrefresh(stdscr);
+			touchwin(T.popup);
+			wnoutrefresh(T.popup);
+			doupdate();
+			T.popup = NULL;
+		} else {
+			refresh();
+		}
+		if (counted && proc_io(&b1, &w1)) {
+			T.out[B_CURSES].bytes += b1 - b0;
+			T.out[B_CURSES].writes += w1 - w0;
+			T.out[B_CURSES].frames += 1;
+		}
+	}
+	if (cells()) {
+		fit_screen();
+		diff_frame();
+		T.out[B_ANSI].frames += 1;
+		if (T.backend == B_ANSI) {
+			if (T.len > 0) {
+				count_write(B_ANSI, T.buf, T.len);
+			}
+		} else {
+			T.out[B_ANSI].bytes += T.len;
+			T.out[B_ANSI].writes += T.len > 0;
+		}
+	}
+}
+
+
+/* Hand the screen back to curses, which must redraw all of it */
+void
+screen_end(void)
+{
+	if (T.backend == B_ANSI) {
+		clearok(curscr, TRUE);
+	}
+}
+
+
+static void
+report(FILE *fp, const char *name, const struct output *o, const char *note)
+{
+	double f = o->frames ? o->frames : 1;
+
+	fprintf(fp, "%s output%s: %lu bytes in %lu writes over %lu frames"
+		" (%.1f bytes and %.2f writes per frame)\n",
+		name, note, o->bytes, o->writes, o->frames,
+		o->bytes / f, o->writes / f);
+}
+
+
+/* Report the output figures of the backends that were measured */
+void
+screen_stats(FILE *fp)
+{
+	if (T.backend == B_CURSES) {
+		if (T.io >= 0) {
+			report(fp, "curses", T.out + B_CURSES, "");
+		}
+		if (T.shadow) {
+			report(fp, "ansi", T.out + B_ANSI, " (computed)");
+		}
+	} else {
+		report(fp, "ansi", T.out + B_ANSI, "");
+	}
+}
@@ -0,0 +1,239 @@
+/*
+ * Session telemetry for letters.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * The game loop pushes fixed size events into a single-producer,
+ * single-consumer ring and never waits: if the ring is full the
+ * event is counted as dropped.  A writer thread drains the ring and
+ * appends one JSON object per line to the log, so however slow the
+ * file system holding the log is, only the writer thread waits on it.
+ * Even the log is opened by the writer thread.
+ */
+
+#include "letters.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* must be a power of 2 */
+#define RING_SIZE 1024
+
+/* How long the writer sleeps when the ring is empty */
+#define WRITER_NAP_MS 100
+
+struct event {
+	enum event_type type;
+	unsigned level;
+	long long a, b;    /* a holds the time of EV_START */
+	unsigned long ns;  /* time since the log was opened */
+	char word[32];
+};
+
+static struct {
+	struct event ring[RING_SIZE];
+	_Atomic unsigned head;  /* next slot to be written by the game */
+	_Atomic unsigned tail;  /* next slot to be read by the writer */
+	_Atomic unsigned long dropped;
+	atomic_bool stop;
+	bool running;
+	pthread_t writer;
+	const char *path;
+	struct timespec start;
+} T;
+
+static const char *event_names[] = {
+	[EV_START] = "start",
+	[EV_LEVEL_START] = "level_start",
+	[EV_LEVEL_END] = "level_end",
+	[EV_WORD] = "word",
+	[EV_MISS] = "miss",
+	[EV_WPM] = "wpm",
+	[EV_BONUS] = "bonus",
+	[EV_END] = "end",
+};
+
+/* Names of the a and b values of each event, if used */
+static const char *event_fields[][2] = {
+	[EV_START] = { "time", NULL },
+	[EV_LEVEL_START] = { "us_per_tick", "bonus" },
+	[EV_LEVEL_END] = { "wpm", "keys" },
+	[EV_WORD] = { "points", NULL },
+	[EV_MISS] = { "bonus", NULL },
+	[EV_WPM] = { "level_wpm", "game_wpm" },
+	[EV_BONUS] = { "points", NULL },
+	[EV_END] = { "score", "words" },
+};
+
+
+static unsigned long
+elapsed_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - T.start.tv_sec) * 1000000000UL
+		+ now.tv_nsec - T.start.tv_nsec;
+}
+
+
+static void
+put_json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; s += 1) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\') {
+			fprintf(fp, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(fp, "\\u%04x", c);
+		} else {
+			fputc(c, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+
+static void
+write_event(FILE *fp, const struct event *e)
+{
+	const char **f = event_fields[e->type];
+
+	fprintf(fp, "{\"t\":%lu.%03lu,\"ev\":\"%s\",\"level\":%u",
+		e->ns / 1000000000, e->ns / 1000000 % 1000,
+		event_names[e->type], e->level);
+	for (int i = 0; i < 2; i += 1) {
+		if (f[i]) {
+			fprintf(fp, ",\"%s\":%lld", f[i], i ? e->b : e->a);
+		}
+	}
+	if (e->word[0]) {
+		fputs(e->type == EV_START ? ",\"user\":" : ",\"word\":", fp);
+		put_json_string(fp, e->word);
+	}
+	fputs("}\n", fp);
+}
+
+
+/* Write out everything in the ring.  Return the number of events. */
+static unsigned
+drain(FILE *fp)
+{
+	unsigned tail = atomic_load_explicit(&T.tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&T.head, memory_order_acquire);
+	unsigned n = head - tail;
+
+	for (; tail != head; tail += 1) {
+		if (fp) {
+			write_event(fp, T.ring + tail % RING_SIZE);
+		}
+	}
+	atomic_store_explicit(&T.tail, tail, memory_order_release);
+	return n;
+}
+
+
+static void *
+writer(void *arg)
+{
+	FILE *fp = fopen(T.path, "a");
+	struct timespec nap = { 0, WRITER_NAP_MS * 1000000L };
+
+	if (fp == NULL) {
+		/* Keep draining so the game never notices */
+		perror(T.path);
+	}
+	while (! atomic_load(&T.stop)) {
+		if (drain(fp) == 0) {
+			if (fp) {
+				fflush(fp);
+			}
+			nanosleep(&nap, NULL);
+		}
+	}
+	drain(fp);
+	if (fp) {
+		unsigned long d = atomic_load(&T.dropped);
+		if (d) {
+			fprintf(fp, "{\"ev\":\"dropped\",\"count\":%lu}\n", d);
+		}
+		fclose(fp);
+	}
+	return arg;
+}
+
+
+/* Start logging events to path */
+void
+telemetry_open(const char *path)
+{
+	sigset_t all, old;
+
+	T.path = path;
+	clock_gettime(CLOCK_MONOTONIC, &T.start);
+
+	/* Leave SIGALRM to the game loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&T.writer, NULL, writer, NULL)) {
+		die("pthread_create");
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	T.running = true;
+}
+
+
+/*
+ * Queue an event.  This never blocks: if the writer has fallen too
+ * far behind the event is dropped.
+ */
+void
+telemetry(enum event_type type, unsigned level, long long a, long long b,
+	const char *word)
+{
+	unsigned head, tail;
+	struct event *e;
+	size_t n;
+
+	if (! T.running) {
+		return;
+	}
+	head = atomic_load_explicit(&T.head, memory_order_relaxed);
+	tail = atomic_load_explicit(&T.tail, memory_order_acquire);
+	if (head - tail == RING_SIZE) {
+		atomic_fetch_add_explicit(&T.dropped, 1, memory_order_relaxed);
+		return;
+	}
+	e = T.ring + head % RING_SIZE;
+	e->type = type;
+	e->level = level;
+	e->a = a;
+	e->b = b;
+	e->ns = elapsed_ns();
+	/* A long word is cut short, but not part way through a character */
+	n = word ? strlen(word) : 0;
+	if (n >= sizeof e->word) {
+		n = sizeof e->word - 1;
+		while (n > 0 && ((unsigned char)word[n] & 0xc0) == 0x80) {
+			n -= 1;
+		}
+	}
+	memcpy(e->word, word ? word : "", n);
+	e->word[n] = '\0';
+	atomic_store_explicit(&T.head, head + 1, memory_order_release);
+}
+
+
+/* Flush the log and stop the writer */
+void
+telemetry_close(void)
+{
+	if (T.running) {
+		atomic_store(&T.stop, true);
+		pthread_join(T.writer, NULL);
+		T.running = false;
+	}
+}
@@ -0,0 +1,166 @@
+/*
+ * Time the ways of splitting a word list into words.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * usage: tokbench [-r rounds] file...
+ *
+ * Each file is read into memory once, then split by the byte at a
+ * time isspace() loop that letters used to load word lists with, and
+ * by tokenize() with each method the processor supports.  The best
+ * of the rounds is reported for each, in megabytes per second.
+ * Build it with "make tokbench".
+ */
+
+#include "letters.h"
+
+#include <getopt.h>
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* The loop letters used: isspace() on each byte, counting the words */
+static size_t
+split_isspace(const char *text, size_t len, size_t *bytes)
+{
+	size_t words = 0;
+	size_t n = 0;
+
+	*bytes = 0;
+	for (size_t i = 0; i <= len; i += 1) {
+		int c = i < len ? (unsigned char)text[i] : EOF;
+
+		if (c == EOF || isspace(c)) {
+			if (n) {
+				words += 1;
+				*bytes += n;
+			}
+			n = 0;
+		} else {
+			n += 1;
+		}
+	}
+	return words;
+}
+
+
+static size_t
+split_tokenize(const char *text, size_t len, size_t *bytes)
+{
+	struct token tok[1024];
+	struct tokenizer t;
+	size_t words = 0;
+	size_t n;
+
+	*bytes = 0;
+	tokenize_start(&t, text, len);
+	while ((n = tokenize(&t, tok, sizeof tok / sizeof *tok)) > 0) {
+		for (size_t i = 0; i < n; i += 1) {
+			*bytes += tok[i].len;
+		}
+		words += n;
+	}
+	return words;
+}
+
+
+static void
+bench(const char *name, size_t (*split)(const char *, size_t, size_t *),
+	const char *text, size_t len, int rounds)
+{
+	uint64_t best = UINT64_MAX;
+	size_t words = 0;
+	size_t bytes = 0;
+
+	for (int i = 0; i < rounds; i += 1) {
+		uint64_t start = now_ns();
+		uint64_t t;
+
+		words = split(text, len, &bytes);
+		if ((t = now_ns() - start) < best) {
+			best = t;
+		}
+	}
+	printf("  %-8s %10zu words %12zu bytes %9.1f MB/s\n", name, words,
+		bytes, best ? len * 1e3 / best : 0.0);
+}
+
+
+static char *
+slurp(const char *path, size_t *len)
+{
+	FILE *fp = fopen(path, "r");
+	char *text = NULL;
+	size_t cap = 0;
+	size_t n;
+
+	if (fp == NULL) {
+		perror(path);
+		exit(1);
+	}
+	*len = 0;
+	do {
+		if (
+			*len == cap
+			&& (text = realloc(text, cap += 1 << 20)) == NULL
+		) {
+			perror("out of memory");
+			exit(1);
+		}
+		*len += n = fread(text + *len, 1, cap - *len, fp);
+	} while (n > 0);
+	if (ferror(fp)) {
+		perror(path);
+		exit(1);
+	}
+	fclose(fp);
+	return text;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	static const char *methods[] = { "scalar", "sse2", "avx2", NULL };
+	int rounds = 10;
+	int c;
+
+	setlocale(LC_ALL, "");
+	while ((c = getopt(argc, argv, "r:")) != -1) {
+		switch (c) {
+		case 'r':
+			rounds = strtol(optarg, NULL, 10);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind == argc || rounds < 1) {
+	usage:
+		fprintf(stderr, "usage: %s [-r rounds] file...\n", argv[0]);
+		return 1;
+	}
+	for (; optind < argc; optind += 1) {
+		size_t len;
+		char *text = slurp(argv[optind], &len);
+
+		printf("%s: %zu bytes\n", argv[optind], len);
+		bench("isspace", split_isspace, text, len, rounds);
+		for (const char **m = methods; *m != NULL; m += 1) {
+			if (tokenize_method(*m)) {
+				bench(*m, split_tokenize, text, len, rounds);
+			}
+		}
+		free(text);
+	}
+	return 0;
+}
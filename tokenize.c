@@ -0,0 +1,257 @@
+/*
+ * Split word lists into whitespace separated tokens.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * The text is classified 64 bytes at a time into two bitmaps, one of
+ * the whitespace bytes and one of the newlines, and tokens are read
+ * off the bitmaps by counting trailing zeros, so the cost is a few
+ * instructions per token rather than a call to isspace() per byte.
+ * Where the processor has them, SSE2 or AVX2 build the bitmaps 16 or
+ * 32 bytes per compare; otherwise plain compares do it a byte at a time.
+ * The choice is made once, at the first call.
+ *
+ * Whitespace is the C locale's: space, tab, newline, vertical tab,
+ * form feed and carriage return.  No other byte is whitespace in any
+ * locale letters runs in, so multibyte characters pass through whole.
+ */
+
+#include "letters.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define X86_SIMD 1
+# include <immintrin.h>
+#endif
+
+#define CHUNK 64
+
+typedef uint64_t classifier(const char *, uint64_t *);
+
+
+static uint64_t
+classify_scalar(const char *p, uint64_t *nl)
+{
+	uint64_t space = 0;
+
+	*nl = 0;
+	for (int i = 0; i < CHUNK; i += 1) {
+		unsigned char c = p[i];
+
+		space |= (uint64_t)(c == ' ' || (c >= '\t' && c <= '\r')) << i;
+		*nl |= (uint64_t)(c == '\n') << i;
+	}
+	return space;
+}
+
+
+#ifdef X86_SIMD
+__attribute__ ((target("sse2")))
+static uint64_t
+classify_sse2(const char *p, uint64_t *nl)
+{
+	const __m128i blank = _mm_set1_epi8(' ');
+	const __m128i lf = _mm_set1_epi8('\n');
+	/* moves '\t' to '\r' to the bottom of the signed bytes */
+	const __m128i bias = _mm_set1_epi8((char)(0x80 - '\t'));
+	const __m128i limit = _mm_set1_epi8((char)(0x80 + '\r' - '\t' + 1));
+	uint64_t space = 0;
+
+	*nl = 0;
+	for (int i = 0; i < CHUNK; i += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i s = _mm_or_si128(_mm_cmpeq_epi8(c, blank),
+			_mm_cmplt_epi8(_mm_add_epi8(c, bias), limit));
+
+		space |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << i;
+		*nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+			_mm_cmpeq_epi8(c, lf)) << i;
+	}
+	return space;
+}
+
+
+__attribute__ ((target("avx2")))
+static uint64_t
+classify_avx2(const char *p, uint64_t *nl)
+{
+	const __m256i blank = _mm256_set1_epi8(' ');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i bias = _mm256_set1_epi8((char)(0x80 - '\t'));
+	const __m256i limit = _mm256_set1_epi8((char)(0x80 + '\r' - '\t'));
+	uint64_t space = 0;
+
+	*nl = 0;
+	for (int i = 0; i < CHUNK; i += 32) {
+		__m256i c = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i b = _mm256_add_epi8(c, bias);
+		/* no signed less than: take b <= limit as !(b > limit) */
+		__m256i s = _mm256_or_si256(_mm256_cmpeq_epi8(c, blank),
+			_mm256_xor_si256(_mm256_cmpgt_epi8(b, limit),
+				_mm256_set1_epi8(-1)));
+
+		space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << i;
+		*nl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(c, lf)) << i;
+	}
+	return space;
+}
+#endif
+
+
+static const struct {
+	const char *name;
+	classifier *classify;
+} methods[] = {  /* best first */
+#ifdef X86_SIMD
+	{ "avx2", classify_avx2 },
+	{ "sse2", classify_sse2 },
+#endif
+	{ "scalar", classify_scalar },
+};
+
+static int method = -1;
+
+
+static bool
+supported(int i)
+{
+#ifdef X86_SIMD
+	__builtin_cpu_init();
+	if (strcmp(methods[i].name, "avx2") == 0) {
+		return __builtin_cpu_supports("avx2");
+	}
+	if (strcmp(methods[i].name, "sse2") == 0) {
+		return __builtin_cpu_supports("sse2");
+	}
+#endif
+	(void)i;
+	return true;
+}
+
+
+/*
+ * Classify with the named method from now on, or, if name is NULL,
+ * with the best the processor supports.  Return the name of the
+ * method chosen, or NULL if the one named is unknown or unsupported.
+ */
+const char *
+tokenize_method(const char *name)
+{
+	int n = sizeof methods / sizeof *methods;
+
+	for (int i = 0; i < n; i += 1) {
+		if ((name == NULL || strcmp(name, methods[i].name) == 0)
+				&& supported(i)) {
+			method = i;
+			return methods[i].name;
+		}
+	}
+	return NULL;
+}
+
+
+/* Start splitting text[0, len) */
+void
+tokenize_start(struct tokenizer *t, const char *text, size_t len)
+{
+	memset(t, 0, sizeof *t);
+	t->text = text;
+	t->len = len;
+	t->line = true;
+	if (method == -1) {
+		tokenize_method(NULL);
+	}
+}
+
+
+/* Add the token that ends just before end */
+static size_t
+emit(struct tokenizer *t, struct token *tok, size_t n, size_t end)
+{
+	tok[n].off = t->start;
+	tok[n].len = end - t->start;
+	tok[n].line = t->first;
+	t->in_word = false;
+	return n + 1;
+}
+
+
+/*
+ * Read the tokens in the n bytes at t->pos, given the bitmaps of their
+ * whitespace and newlines, into tok[count...].  Return the new count.
+ */
+static size_t
+scan(struct tokenizer *t, uint64_t space, uint64_t nl, int n,
+	struct token *tok, size_t count)
+{
+	uint64_t valid = n == CHUNK ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1;
+	int i = 0;
+
+	while (i < n) {
+		uint64_t rest = (valid >> i) << i;
+		uint64_t next;
+
+		if (t->in_word) {
+			if ((next = space & rest) == 0) {
+				break;
+			}
+			i = __builtin_ctzll(next);
+			count = emit(t, tok, count, t->pos + i);
+		} else {
+			if ((next = ~space & rest) == 0) {
+				t->line |= (nl & rest) != 0;
+				break;
+			}
+			i = __builtin_ctzll(next);
+			t->line |= (nl & rest & (((uint64_t)1 << i) - 1)) != 0;
+			t->start = t->pos + i;
+			t->first = t->line;
+			t->line = false;
+			t->in_word = true;
+		}
+	}
+	return count;
+}
+
+
+/*
+ * Put the next tokens of the text in tok, which has room for max of
+ * them, at least TOKENS_MIN.  Return how many were found: 0 once the
+ * text is used up.
+ */
+size_t
+tokenize(struct tokenizer *t, struct token *tok, size_t max)
+{
+	classifier *classify = methods[method].classify;
+	size_t count = 0;
+
+	assert(max >= TOKENS_MIN);
+	/* A chunk ends at most CHUNK / 2 tokens, and the text one more */
+	while (t->len - t->pos >= CHUNK && max - count > CHUNK / 2) {
+		uint64_t nl;
+		uint64_t space = classify(t->text + t->pos, &nl);
+
+		count = scan(t, space, nl, CHUNK, tok, count);
+		t->pos += CHUNK;
+	}
+	if (t->len - t->pos < CHUNK && max - count > CHUNK / 2) {
+		char tail[CHUNK];
+		int n = t->len - t->pos;
+		uint64_t nl;
+		uint64_t space;
+
+		memset(tail, ' ', sizeof tail);
+		if (n > 0) {
+			memcpy(tail, t->text + t->pos, n);
+		}
+		space = classify(tail, &nl);
+		count = scan(t, space, nl, n, tok, count);
+		t->pos += n;
+		if (t->in_word) {
+			count = emit(t, tok, count, t->pos);
+		}
+	}
+	return count;
+}
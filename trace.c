@@ -0,0 +1,154 @@
+/*
+ * Time the phases of starting a game.
+ *
+ * copyright 2025 William Pursell (william.r.pursell@gmail.com)
+ */
+
+/*
+ * init() calls trace_phase() as it enters each phase of getting the
+ * first frame on the screen, and trace_done() once it is there.  Each
+ * call takes the time on the monotonic clock, the page faults from
+ * getrusage(), the allocations counted by alloc.c and, where malloc
+ * can say, the bytes of heap in use, so that each phase is charged
+ * with the difference between the samples at its start and its end.
+ * Sampling costs a couple of microseconds, so it is always done, and
+ * --trace-startup only decides whether and how the phases are shown:
+ * as a table after the game, or as a Chrome trace (chrome://tracing,
+ * or ui.perfetto.dev) written to a file as soon as the frame is up.
+ * Major faults are pages read from disk, which is where a cold cache
+ * shows itself.
+ */
+
+#include "letters.h"
+
+#include <sys/resource.h>
+#ifdef HAVE_MALLINFO2
+# include <malloc.h>
+#endif
+
+#define MAX_PHASES 16
+
+static struct sample {
+	const char *name;       /* of the phase starting here */
+	uint64_t ns;
+	long minflt;
+	long majflt;
+	unsigned long allocs;
+	long long heap;
+} P[MAX_PHASES + 1];
+
+static int count;          /* samples taken */
+static bool on;
+static const char *path;   /* of the Chrome trace, or NULL for a table */
+
+
+static void
+sample(struct sample *s, const char *name)
+{
+	struct rusage ru;
+
+	s->name = name;
+	s->ns = monotonic_ns();
+	getrusage(RUSAGE_SELF, &ru);
+	s->minflt = ru.ru_minflt;
+	s->majflt = ru.ru_majflt;
+	s->allocs = alloc_total();
+#ifdef HAVE_MALLINFO2
+	s->heap = mallinfo2().uordblks;
+#else
+	s->heap = 0;
+#endif
+}
+
+
+/* End the current phase of startup, if any, and begin the named one */
+void
+trace_phase(const char *name)
+{
+	if (count < MAX_PHASES) {
+		sample(P + count++, name);
+	}
+}
+
+
+/*
+ * Show the phases of startup: in a Chrome trace written to file, or
+ * if file is NULL, in a table printed by trace_report().  Must be
+ * called before the first allocation is made.
+ */
+void
+trace_startup(const char *file)
+{
+	on = true;
+	path = file;
+	alloc_count(false);
+}
+
+
+static void
+write_trace(void)
+{
+	FILE *fp = fopen(path, "w");
+	uint64_t t0 = P[0].ns;
+
+	if (fp == NULL) {
+		perror(path);
+		return;
+	}
+	fputs("{\"traceEvents\":[\n", fp);
+	for (int i = 0; i + 1 < count; i += 1) {
+		struct sample *a = P + i, *b = P + i + 1;
+
+		fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"startup\","
+			"\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+			"\"pid\":%d,\"tid\":1,\"args\":{"
+			"\"minflt\":%ld,\"majflt\":%ld,"
+			"\"allocs\":%lu,\"heap\":%lld}}\n",
+			i ? "," : "", a->name, (a->ns - t0) / 1e3,
+			(b->ns - a->ns) / 1e3, (int)getpid(),
+			b->minflt - a->minflt, b->majflt - a->majflt,
+			b->allocs - a->allocs, b->heap - a->heap);
+	}
+	fputs("],\"displayTimeUnit\":\"ms\"}\n", fp);
+	if (fclose(fp)) {
+		perror(path);
+	}
+}
+
+
+/* End the last phase of startup: the first frame is on the screen */
+void
+trace_done(void)
+{
+	sample(P + count++, NULL);
+	if (on && path) {
+		write_trace();
+	}
+}
+
+
+/* Print the table of startup phases, if one was asked for */
+void
+trace_report(FILE *fp)
+{
+	struct sample *a, *b;
+
+	if (! on || path || count < 2) {
+		return;
+	}
+	fprintf(fp, "%-16s %9s %8s %8s %8s %10s\n", "startup", "ms",
+		"minflt", "majflt", "allocs", "heap");
+	for (int i = 0; i + 1 < count; i += 1) {
+		a = P + i, b = P + i + 1;
+
+		fprintf(fp, "%-16s %9.3f %8ld %8ld %8lu %10lld\n", a->name,
+			(b->ns - a->ns) / 1e6, b->minflt - a->minflt,
+			b->majflt - a->majflt, b->allocs - a->allocs,
+			b->heap - a->heap);
+	}
+	a = P, b = P + count - 1;
+	fprintf(fp, "%-16s %9.3f %8ld %8ld %8lu %10lld\n", "total",
+		(b->ns - a->ns) / 1e6, b->minflt - a->minflt,
+		b->majflt - a->majflt, b->allocs - a->allocs,
+		b->heap - a->heap);
+}
@@ -7,35 +7,246 @@
 
 #include "letters.h"
 
+#include <stdatomic.h>
+
 # define random lrand48
 
 extern char *choice;
 
-static struct dictionary word_dict = {NULL, 0, 0};
-static struct dictionary bonus_dict = {NULL, 0, 0};
+static struct dictionary word_dict = {0};
+static struct dictionary bonus_dict = {0};
 extern struct dictionary default_dict[];
 static struct dictionary *dict = &word_dict;
+static bool adaptive;  /* adapt_dictionary() has been called */
+static struct markov *model;  /* makes up the words, if not NULL */
 
+/*
+ * A reloaded dictionary waiting to be swapped in by getword(), and the
+ * dictionaries it has replaced, waiting to be freed by the thread
+ * that loaded it.
+ */
+static _Atomic(struct dictionary *) fresh;
+static _Atomic(struct dictionary *) stale;
+
+static void free_dict(struct dictionary *);
 static void push_char(struct string *, int, reallocator);
 
+/*
+ * Build a string of random characters from string.  Character i of
+ * string is the bytes string[off[i]] up to string[off[i + 1]].
+ */
 static struct string
-build_random_string(const char *string, reallocator r)
+build_random_string(const char *string, const size_t *off, size_t len,
+	reallocator r)
 {
-	struct string p = {NULL, 0};
+	struct string p = { .data = NULL, .len = 0 };
 	size_t wlen;
-	size_t len = strlen(string);
 
 	wlen = MINSTRING + (random() % (MAXSTRING - MINSTRING));
 	while (wlen--) {
-		push_char(&p, string[random() % len], r);
+		size_t i = random() % len;
+		for (size_t k = off[i]; k < off[i + 1]; k += 1) {
+			push_char(&p, string[k], r);
+		}
 	}
 	push_char(&p, '\0', r);
 	return p;
 }
 
+
+/* Return true if the string is plain ASCII, setting its counts if so */
+static bool
+ascii_string(struct string *s)
+{
+	size_t n = s->len - 1;
+	size_t i;
+
+	for (i = 0; i < n && !(s->data[i] & 0x80); i += 1) {
+		;
+	}
+	s->wide = NULL;
+	if (i == n) {
+		s->nchar = s->width = n;
+	}
+	return i == n;
+}
+
+
+/*
+ * Decode s into wide, which has room for s->len characters, and count
+ * the characters and the columns they take on screen.  Bytes that do
+ * not decode are taken as characters of width 1 on their own.
+ */
+static void
+decode_into(struct string *s, wchar_t *wide)
+{
+	const char *p = s->data;
+	size_t n = s->len - 1;
+	mbstate_t st;
+
+	s->wide = wide;
+	memset(&st, 0, sizeof st);
+	s->nchar = s->width = 0;
+	while (n > 0) {
+		wchar_t c;
+		size_t k = mbrtowc(&c, p, n, &st);
+		int w;
+
+		if (k == 0 || k > n) {
+			c = (unsigned char)*p;
+			k = 1;
+			memset(&st, 0, sizeof st);
+		}
+		w = wcwidth(c);
+		s->wide[s->nchar++] = c;
+		s->width += w < 0 ? 1 : w;
+		p += k;
+		n -= k;
+	}
+	s->wide[s->nchar] = L'\0';
+}
+
+
+/*
+ * Count the characters of s and the columns they take on screen.
+ * Strings that are not plain ASCII are also decoded into s->wide.
+ * This is done once, as the string enters a dictionary, so that
+ * neither matching keys against a word nor drawing it ever needs to
+ * decode it again.
+ */
+static void
+decode_string(struct string *s, reallocator r)
+{
+	wchar_t *wide;
+
+	if (ascii_string(s)) {
+		return;
+	}
+	if ((wide = r(NULL, s->len * sizeof *wide)) == NULL) {
+		perror("out of memory");
+		exit(1);
+	}
+	decode_into(s, wide);
+}
+
+
+/*
+ * Count the characters of s and the columns it takes on screen, and
+ * if it is not plain ASCII, decode it into wide, which has room for
+ * s->len characters.
+ */
+void
+measure_string(struct string *s, wchar_t *wide)
+{
+	if (! ascii_string(s)) {
+		decode_into(s, wide);
+	}
+}
+
+
+/* Return the length of the prefix shared by a and b */
+static size_t
+shared_prefix(const char *a, const char *b)
+{
+	size_t i = 0;
+
+	while (a[i] && a[i] == b[i]) {
+		i += 1;
+	}
+	return i;
+}
+
+
+/*
+ * Replace the words of d by their front coding: in each block of
+ * FC_BLOCK words, the first is stored as its length and its bytes,
+ * and each of the others as the length of the prefix it shares with
+ * the word before it, the length of the rest, and the rest.  A sorted
+ * list, in which neighbours share long prefixes, shrinks to a small
+ * fraction of the size of separately allocated strings, and any word
+ * can be found by decoding at most one block.  The text of the words
+ * is left to the caller to free.
+ */
+static void
+pack_dictionary(struct dictionary *d, reallocator r)
+{
+	size_t size = 0;
+	unsigned char *blocks, *p;
+	uint32_t *block;
+
+	for (size_t i = 0; i < d->len; i += 1) {
+		size_t len = d->index[i].len - 1;
+
+		if (i % FC_BLOCK == 0) {
+			size += 1 + len;
+		} else {
+			size += 2 + len - shared_prefix(d->index[i - 1].data,
+				d->index[i].data);
+		}
+	}
+	blocks = r(NULL, size + 1);
+	block = r(NULL, (d->len / FC_BLOCK + 1) * sizeof *block);
+	if (blocks == NULL || block == NULL) {
+		perror("out of memory");
+		exit(1);
+	}
+	p = blocks;
+	for (size_t i = 0; i < d->len; i += 1) {
+		const struct string *s = d->index + i;
+		size_t len = s->len - 1;
+		size_t k = 0;
+
+		if (i % FC_BLOCK == 0) {
+			block[i / FC_BLOCK] = p - blocks;
+			*p++ = len;
+		} else {
+			k = shared_prefix(s[-1].data, s->data);
+			*p++ = k;
+			*p++ = len - k;
+		}
+		memcpy(p, s->data + k, len - k);
+		p += len - k;
+	}
+	for (size_t i = 0; i < d->len; i += 1) {
+		r(d->index[i].wide, 0);
+	}
+	r(d->index, 0);
+	d->index = NULL;
+	d->cap = 0;
+	d->blocks = blocks;
+	d->block = block;
+}
+
+
+/* Decode word i of a front coded dictionary into buf */
+static struct string
+unpack_word(const struct dictionary *d, size_t i, struct wordbuf *buf)
+{
+	const unsigned char *p = d->blocks + d->block[i / FC_BLOCK];
+	struct string s = { .data = buf->data };
+	size_t len = *p++;
+
+	memcpy(buf->data, p, len);
+	p += len;
+	for (size_t k = i % FC_BLOCK; k > 0; k -= 1) {
+		size_t shared = *p++;
+		size_t rest = *p++;
+
+		memcpy(buf->data + shared, p, rest);
+		p += rest;
+		len = shared + rest;
+	}
+	buf->data[len] = '\0';
+	s.len = len + 1;
+	measure_string(&s, buf->wide);
+	return s;
+}
+
+
 static int
 push_string(struct dictionary *d, struct string s, reallocator r)
 {
+	decode_string(&s, r);
 	if (d->len >= d->cap) {
 		void *tmp = r(d->index, (d->cap + 1024) * sizeof *d->index);
 		if (tmp == NULL) {
@@ -44,17 +255,128 @@ push_string(struct dictionary *d, struct string s, reallocator r)
 			return -1;
 		}
 		d->index = tmp;
+		if (d->weight) {
+			tmp = r(d->weight, (d->cap + 1024) * sizeof *d->weight);
+			if (tmp == NULL) {
+				perror("out of memory");
+				exit(1);
+			}
+			d->weight = tmp;
+		}
 		d->cap += 1024;
 	}
+	if (d->weight) {
+		d->weight[d->len] = 1.0;
+	}
 	d->index[d->len++] = s;
 	return 0;
 }
 
+
+/*
+ * Set the relative frequency of word i.  The weight array is only
+ * allocated once a list actually has a frequency column, with every
+ * word seen so far given weight 1.
+ */
+static void
+set_weight(struct dictionary *d, size_t i, float w, reallocator r)
+{
+	if (d->weight == NULL) {
+		d->weight = r(NULL, d->cap * sizeof *d->weight);
+		if (d->weight == NULL) {
+			perror("out of memory");
+			exit(1);
+		}
+		for (size_t j = 0; j < d->len; j += 1) {
+			d->weight[j] = 1.0;
+		}
+	}
+	d->weight[i] = w;
+}
+
+
+/* Return true iff s is a frequency (a non-negative number) */
+static bool
+parse_weight(const struct string *s, float *w)
+{
+	char *end;
+	double v = strtod(s->data, &end);
+
+	if (end == s->data || *end != '\0' || !(v >= 0.0) || isinf(v)) {
+		return false;
+	}
+	*w = v;
+	return true;
+}
+
+
+/*
+ * Build a Walker/Vose alias table from d->weight so that getword() can
+ * draw in proportion to frequency with one random column and one coin
+ * flip.  Construction is linear: columns that are under-full are paired
+ * with an over-full donor exactly once.
+ */
+static bool
+build_alias(struct dictionary *d, reallocator r)
+{
+	size_t n = d->len;
+	size_t small = 0;  /* work[0, small) holds columns with prob < 1 */
+	size_t large = n;  /* work[large, n) holds columns with prob >= 1 */
+	unsigned *work;
+	double sum = 0.0;
+
+	if (d->weight == NULL || n == 0) {
+		return true;
+	}
+	for (size_t i = 0; i < n; i += 1) {
+		sum += d->weight[i];
+	}
+	if (!(sum > 0.0)) {
+		return false;
+	}
+	d->alias = r(NULL, n * sizeof *d->alias);
+	work = r(NULL, n * sizeof *work);
+	if (d->alias == NULL || work == NULL) {
+		perror("out of memory");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < n; i += 1) {
+		d->alias[i].prob = d->weight[i] * n / sum;
+		d->alias[i].alias = i;
+		if (d->alias[i].prob < 1.0) {
+			work[small++] = i;
+		} else {
+			work[--large] = i;
+		}
+	}
+	while (small > 0 && large < n) {
+		unsigned s = work[--small];
+		unsigned g = work[large];
+
+		d->alias[s].alias = g;
+		d->alias[g].prob -= 1.0 - d->alias[s].prob;
+		if (d->alias[g].prob < 1.0) {
+			large += 1;
+			work[small++] = g;
+		}
+	}
+	/* Anything left over is full up to rounding error */
+	while (small > 0) {
+		d->alias[work[--small]].prob = 1.0;
+	}
+	while (large < n) {
+		d->alias[work[large++]].prob = 1.0;
+	}
+	r(work, 0);
+	return true;
+}
+
 static void
 push_char(struct string *s, int c, reallocator r)
 {
 	if (s->len % 32 == 0) {
-		if (s->len >= 224) {
+		if (s->len >= MAXWORD) {
 			fprintf(stderr, "strings cannot exceed length 223");
 			exit(1);
 		}
@@ -72,47 +394,167 @@ push_char(struct string *s, int c, reallocator r)
 static void
 initialize_dict_from_string(struct dictionary *d, char *choice, reallocator r)
 {
+	size_t n = 0;
+	size_t len = strlen(choice);
+	size_t *off = r(NULL, (len + 1) * sizeof *off);
+	mbstate_t st;
+
+	if (off == NULL) {
+		perror("out of memory");
+		exit(1);
+	}
+	memset(&st, 0, sizeof st);
+	for (size_t i = 0; i < len; n += 1) {
+		size_t k = mbrtowc(NULL, choice + i, len - i, &st);
+		if (k == 0 || k > len - i) {
+			k = 1;
+			memset(&st, 0, sizeof st);
+		}
+		off[n] = i;
+		i += k;
+	}
+	off[n] = len;
 	for (int i = 0; i < 1024; i += 1) {
-		push_string(d, build_random_string(choice, r), r);
+		push_string(d, build_random_string(choice, off, n, r), r);
 	}
+	r(off, 0);
 }
 
 
-static void
-initialize_dict_from_path(char *path, reallocator r)
+/*
+ * Read all of path into memory allocated with r, with room for a nul
+ * after it.  Return NULL if it can not be read.
+ */
+static char *
+read_file(const char *path, size_t *len, reallocator r)
 {
-	FILE *fp;
 	struct stat s_buf;
-	int c;
-	struct string s = {NULL, 0};
-	if(
-		(fp = fopen(path, "r")) == NULL ||
-		stat(path, &s_buf) == -1
-	) {
-		perror(path);
-		exit(1);
+	size_t cap = 65536;
+	size_t n = 0;
+	char *buf = NULL;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		return NULL;
 	}
+	if (fstat(fd, &s_buf) == 0 && s_buf.st_size > 0) {
+		cap = s_buf.st_size + 1;
+	}
+	for (;;) {
+		ssize_t k;
 
-	dict = &word_dict;
-	while( (c = fgetc(fp)) != EOF ){
-		if (isspace(c)) {
-			if (s.data != NULL) {
-				push_char(&s, 0, r);
-				push_string(dict, s, r);
-				s.data = NULL;
-				s.len = 0;
+		if (buf == NULL || n == cap) {
+			void *tmp = r(buf, buf ? cap *= 2 : cap);
+			if (tmp == NULL) {
+				perror("out of memory");
+				exit(1);
+			}
+			buf = tmp;
+		}
+		if ((k = read(fd, buf + n, cap - n)) == 0) {
+			break;
+		}
+		if (k == -1 && errno != EINTR) {
+			close(fd);
+			r(buf, 0);
+			return NULL;
+		}
+		n += k > 0 ? k : 0;
+	}
+	close(fd);
+	*len = n;
+	return buf;
+}
+
+
+/*
+ * Read whitespace separated words from path and front code them.  A
+ * number that is the second field on a line is taken as the relative
+ * frequency of the word before it rather than as a word.  Return false
+ * if path can not be read.
+ *
+ * The words are not copied out of the file one by one: each is cut
+ * off where it lies by writing a nul over the whitespace after it,
+ * and the index points at it there until it is packed.
+ */
+static bool
+initialize_dict_from_path(struct dictionary *d, const char *path,
+	reallocator r)
+{
+	struct token tok[1024];
+	struct tokenizer t;
+	int field = 0;  /* index of the current token within its line */
+	size_t len, n;
+	char *text;
+
+	if ((text = read_file(path, &len, r)) == NULL) {
+		return false;
+	}
+	tokenize_start(&t, text, len);
+	while ((n = tokenize(&t, tok, sizeof tok / sizeof *tok)) > 0) {
+		for (size_t i = 0; i < n; i += 1) {
+			struct string s = {
+				.data = text + tok[i].off,
+				.len = tok[i].len + 1
+			};
+			float w;
+
+			if (tok[i].len >= MAXWORD) {
+				fprintf(stderr,
+					"strings cannot exceed length 223\n");
+				exit(1);
+			}
+			s.data[tok[i].len] = '\0';
+			field = tok[i].line ? 0 : field + 1;
+			if (field == 1 && parse_weight(&s, &w)) {
+				set_weight(d, d->len - 1, w, r);
+			} else {
+				push_string(d, s, r);
 			}
-		} else {
-			push_char(&s, c, r);
 		}
 	}
+	if (d->len > 0) {
+		pack_dictionary(d, r);
+	}
+	r(text, 0);
+	return true;
 }
 
 
 static void init_bonus_words(reallocator r);
 
-void
-initialize_dictionary(char *path, char *dict_string, reallocator r)
+
+/* Train a model of the words of d, allocating with r */
+static struct markov *
+train_model(const struct dictionary *d, reallocator r)
+{
+	struct markov *m = markov_new(r);
+	struct wordbuf buf;
+
+	for (size_t i = 0; i < d->len; i += 1) {
+		struct string s = d->index ? d->index[i]
+			: unpack_word(d, i, &buf);
+
+		markov_add(m, &s);
+	}
+	if (! markov_finish(m)) {
+		fprintf(stderr, "no words to make up words from\n");
+		exit(1);
+	}
+	return m;
+}
+
+
+/*
+ * Load the word list, allocating with r, and the bonus strings,
+ * allocating with bonus.  If path holds a model written by
+ * save_word_model(), or if pseudo is set, words are made up from a
+ * model of the list rather than drawn from it, and the list is freed
+ * once the model is trained.  Return true if words are made up.
+ */
+bool
+initialize_dictionary(char *path, char *dict_string, bool pseudo,
+	reallocator r, reallocator bonus)
 {
 	char *bonus_chars =
 		"abcdefghijklmnopqrstuvwxyz"
@@ -121,21 +563,279 @@ initialize_dictionary(char *path, char *dict_string, reallocator r)
 		"0123456789"
 		"+!?.,@#$%^&*()-_[]{}~|\\";
 
+	word_dict.r = default_dict->r = r;
+	bonus_dict.r = bonus;
 	if (dict_string) {
 		initialize_dict_from_string(&word_dict, dict_string, r);
+	} else if (path && (model = markov_read(path, r)) != NULL) {
+		dict = &word_dict;
 	} else if (path) {
-		initialize_dict_from_path(path, r);
+		if (! initialize_dict_from_path(&word_dict, path, r)) {
+			perror(path);
+			exit(1);
+		}
 	} else {
 		dict = default_dict;
 	}
+	if (model == NULL && ! build_alias(dict, r)) {
+		fprintf(stderr, "word frequencies sum to zero\n");
+		exit(1);
+	}
+	if (model == NULL && pseudo) {
+		trace_phase("word model");
+		model = train_model(dict, r);
+		free_dict(&word_dict);
+		dict = &word_dict;
+	}
+
+	trace_phase("bonus words");
+	initialize_dict_from_string(&bonus_dict, bonus_chars, bonus);
+	return model != NULL;
+}
+
+
+/* Write the model of the word list to path */
+void
+save_word_model(const char *path)
+{
+	markov_write(model, path);
+}
+
+/* Fenwick tree update: add delta to the weight of word i */
+static void
+tree_add(struct dictionary *d, size_t i, double delta)
+{
+	for (i += 1; i <= d->len; i += i & -i) {
+		d->tree[i] += delta;
+	}
+	d->total += delta;
+}
+
+
+/* Return the word whose cumulative weight range contains u */
+static size_t
+tree_find(const struct dictionary *d, double u)
+{
+	size_t pos = 0;
+	size_t step = 1;
+
+	while (step <= d->len / 2) {
+		step <<= 1;
+	}
+	for (; step; step >>= 1) {
+		if (pos + step <= d->len && d->tree[pos + step] <= u) {
+			pos += step;
+			u -= d->tree[pos];
+		}
+	}
+	return pos < d->len ? pos : d->len - 1;
+}
+
+
+static double
+adapted_weight(const struct dictionary *d, size_t i)
+{
+	double base = d->weight ? d->weight[i] : 1.0;
+	struct wordbuf buf;
+	const char *w = d->index ? d->index[i].data
+		: unpack_word(d, i, &buf).data;
+
+	return base * (1.0 + drill_difficulty(w));
+}
+
+
+/*
+ * Build the Fenwick tree of d's adaptive weights in linear time.  The
+ * weights are scaled by drill_difficulty() only if difficulty is true:
+ * it reads the typing statistics, which only the game thread may do.
+ */
+static void
+build_tree(struct dictionary *d, reallocator r, bool difficulty)
+{
+	size_t n = d->len;
+
+	d->tree = r(NULL, (n + 1) * sizeof *d->tree);
+	d->adapted = r(NULL, n * sizeof *d->adapted);
+	if (d->tree == NULL || d->adapted == NULL) {
+		perror("out of memory");
+		exit(1);
+	}
+	d->tree[0] = d->total = 0.0;
+	for (size_t i = 0; i < n; i += 1) {
+		d->adapted[i] = ! difficulty ? (d->weight ? d->weight[i] : 1.0)
+			: adapted_weight(d, i);
+		d->tree[i + 1] = d->adapted[i];
+		d->total += d->adapted[i];
+	}
+	for (size_t i = 1; i <= n; i += 1) {
+		size_t j = i + (i & -i);
+		if (j <= n) {
+			d->tree[j] += d->tree[i];
+		}
+	}
+	d->sweep = 0;
+}
+
+
+/*
+ * Switch the current dictionary to adaptive draws: each word gets a
+ * weight of its frequency scaled by drill_difficulty(), kept in a
+ * Fenwick tree so that a weight can be changed, and a word drawn,
+ * in O(log n).
+ */
+void
+adapt_dictionary(reallocator r)
+{
+	build_tree(dict, r, true);
+	adaptive = true;
+}
+
+
+/*
+ * Rescore the next count words against the current typing statistics.
+ * Called a little at a time from the game loop so that the weights
+ * follow the typist without ever rescoring the whole list at once.
+ */
+void
+adapt_words(unsigned count)
+{
+	struct dictionary *d = dict;
+
+	if (d->tree == NULL) {
+		return;
+	}
+	while (count--) {
+		size_t i = d->sweep;
+		float w = adapted_weight(d, i);
 
-	initialize_dict_from_string(&bonus_dict, bonus_chars, r);
+		if (w != d->adapted[i]) {
+			tree_add(d, i, (double)w - d->adapted[i]);
+			d->adapted[i] = w;
+		}
+		d->sweep = (i + 1) % d->len;
+	}
 }
 
+
+/*
+ * Swap in the dictionary waiting in fresh, and hand the one it
+ * replaces to the loading thread to be freed.  Words in play from a
+ * front coded dictionary hold their own copy of their text, so the
+ * old dictionary can go at once; one that is not front coded is kept,
+ * since words in play still point into it.
+ */
+static void
+swap_dictionary(void)
+{
+	struct dictionary *d = atomic_exchange_explicit(&fresh, NULL,
+		memory_order_acquire);
+	struct dictionary *old = dict;
+
+	if (d == NULL) {
+		return;
+	}
+	dict = d;
+	if (old->blocks && old != default_dict) {
+		old->retired = atomic_load_explicit(&stale,
+			memory_order_relaxed);
+		while (
+			! atomic_compare_exchange_weak_explicit(&stale,
+				&old->retired, old, memory_order_release,
+				memory_order_relaxed)
+		) {
+			;
+		}
+	}
+}
+
+
+/*
+ * Build a dictionary from path in the calling thread, as -d does,
+ * allocating with r.  Return NULL if path can not be read or holds no
+ * words.  The typing statistics belong to the game thread, so in
+ * adaptive mode the words start at their plain weights and are
+ * rescored by adapt_words() once the dictionary is in use.
+ */
+struct dictionary *
+load_dictionary(const char *path, reallocator r)
+{
+	struct dictionary *d = r(NULL, sizeof *d);
+
+	if (d == NULL) {
+		return NULL;
+	}
+	memset(d, 0, sizeof *d);
+	d->r = r;
+	if (! initialize_dict_from_path(d, path, r) || d->len == 0) {
+		discard_dictionary(d);
+		return NULL;
+	}
+	if (! build_alias(d, r)) {
+		discard_dictionary(d);
+		return NULL;
+	}
+	if (adaptive) {
+		build_tree(d, r, false);
+	}
+	return d;
+}
+
+
+/*
+ * Offer d to be swapped in at the next draw, in place of any offered
+ * before it that has not yet been taken.  Only one thread may offer
+ * dictionaries, and it must also collect them.
+ */
+void
+offer_dictionary(struct dictionary *d)
+{
+	discard_dictionary(atomic_exchange_explicit(&fresh, d,
+		memory_order_acq_rel));
+	collect_dictionaries();
+}
+
+
+/* Free the dictionaries that have been swapped out */
+void
+collect_dictionaries(void)
+{
+	struct dictionary *old = atomic_exchange_explicit(&stale, NULL,
+		memory_order_acquire);
+
+	while (old) {
+		struct dictionary *next = old->retired;
+		discard_dictionary(old);
+		old = next;
+	}
+}
+
+
+/*
+ * Draw a word with the random number stream rng: made up by the model
+ * if there is one, by adaptive weight if enabled, else in proportion
+ * to its frequency if the list has any, else uniformly.  A word from
+ * a front coded list or the model is put in buf.
+ */
 struct string
-getword(void)
+getword(struct wordbuf *buf, unsigned short rng[3])
 {
-	return dict->index[random() % dict->len];
+	size_t i;
+
+	if (model) {
+		return markov_word(model, buf, rng);
+	}
+	if (atomic_load_explicit(&fresh, memory_order_relaxed)) {
+		swap_dictionary();
+	}
+	if (dict->tree) {
+		i = tree_find(dict, erand48(rng) * dict->total);
+	} else {
+		i = nrand48(rng) % dict->len;
+		if (dict->alias && erand48(rng) >= dict->alias[i].prob) {
+			i = dict->alias[i].alias;
+		}
+	}
+	return dict->index ? dict->index[i] : unpack_word(dict, i, buf);
 }
 
 
@@ -143,26 +843,101 @@ static void
 free_dict(struct dictionary *d)
 {
 	struct string *s = d->index;
-	struct string *e = d->index + d->len;
+	struct string *e = d->index ? d->index + d->len : NULL;
+
+	if (d->r == NULL) {
+		return;
+	}
 	while ( s < e ){
-		free(s++ -> data);
+		d->r(s->wide, 0);
+		d->r(s++ -> data, 0);
 	}
-	free(d->index);
+	d->r(d->index, 0);
+	d->r((void *)d->blocks, 0);
+	d->r((void *)d->block, 0);
+	d->r(d->weight, 0);
+	d->r(d->alias, 0);
+	d->r(d->tree, 0);
+	d->r(d->adapted, 0);
 	d->index = NULL;
+	d->blocks = NULL;
+	d->block = NULL;
+	d->weight = NULL;
+	d->alias = NULL;
+	d->tree = NULL;
+	d->adapted = NULL;
 	d->cap = d->len = 0;
 }
 
 
+/* Free a dictionary made by load_dictionary() or swapped out */
+void
+discard_dictionary(struct dictionary *d)
+{
+	if (d) {
+		reallocator r = d->r;
+		free_dict(d);
+		if (d != &word_dict) {
+			r(d, 0);
+		}
+	}
+}
+
+
 void
 free_dictionaries(void)
 {
+	reallocator r = default_dict->r;
+
+	offer_dictionary(NULL);
+	markov_free(model);
+	model = NULL;
+	if (dict != &word_dict && dict != default_dict) {
+		discard_dictionary(dict);
+		dict = &word_dict;
+	}
+
 	free_dict(&word_dict);
 	free_dict(&bonus_dict);
+	if (r == NULL) {
+		return;
+	}
+	r(default_dict->alias, 0);
+	r(default_dict->tree, 0);
+	r(default_dict->adapted, 0);
+	default_dict->alias = NULL;
+	default_dict->tree = NULL;
+	default_dict->adapted = NULL;
 }
 
 
 struct string
-bonusword(void)
+bonusword(unsigned short rng[3])
+{
+	return bonus_dict.index[nrand48(rng) % bonus_dict.len];
+}
+
+
+/*
+ * Return a hash of the words that getword() draws from, so that two
+ * games can tell whether they would draw the same words.
+ */
+uint32_t
+dictionary_fingerprint(void)
 {
-	return bonus_dict.index[random() % bonus_dict.len];
+	uint32_t h = 2166136261u;  /* FNV-1a */
+	struct wordbuf buf;
+
+	if (model) {
+		return markov_fingerprint(model);
+	}
+	for (size_t i = 0; i < dict->len; i += 1) {
+		struct string s = dict->index ? dict->index[i]
+			: unpack_word(dict, i, &buf);
+
+		for (int k = 0; k < s.len; k += 1) {
+			h = (h ^ (unsigned char)s.data[k]) * 16777619u;
+		}
+	}
+	return h;
 }